@@ -0,0 +1,288 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <mutex>
+#include <vector>
+
+#include "../src/beta_dungeons.hpp"
+
+// Python side of the library. Blocks and scan results are handed out as objects implementing the buffer protocol
+// over memory they own, so numpy.asarray() (or memoryview) views them without copying. The GIL is released
+// while terrain is generated; each World serialises its own calls with a mutex taken after the GIL is dropped.
+
+typedef struct {
+    PyObject_HEAD
+    World *world;
+    std::mutex *lock;
+} PyWorld;
+
+typedef struct {
+    PyObject_HEAD
+    uint8_t *blocks;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+} PyBlocks;
+
+typedef struct {
+    PyObject_HEAD
+    std::vector<DungeonResult> *results;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+} PyResults;
+
+static PyTypeObject PyBlocksType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+static PyTypeObject PyResultsType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+static PyTypeObject PyWorldType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+// chunk blocks as a read only uint8 array of shape (16, 16, 128) indexed [x][z][y], the layout getBlockID reads
+static void blocksDealloc(PyBlocks *self) {
+    delete[] self->blocks;
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int blocksGetBuffer(PyBlocks *self, Py_buffer *view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "chunk blocks are read only");
+        return -1;
+    }
+    view->buf = self->blocks;
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->len = 16 * 16 * 128;
+    view->readonly = 1;
+    view->itemsize = 1;
+    view->format = (flags & PyBUF_FORMAT) ? (char *)"B" : nullptr;
+    view->ndim = 3;
+    view->shape = self->shape;
+    view->strides = self->strides;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    return 0;
+}
+
+static PyBufferProcs blocksBuffer = {(getbufferproc)blocksGetBuffer, nullptr};
+
+// dungeons of a scan as an int32 array of shape (n, 2) holding x, z, strided straight over the DungeonResults
+static void resultsDealloc(PyResults *self) {
+    delete self->results;
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int resultsGetBuffer(PyResults *self, Py_buffer *view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "scan results are read only");
+        return -1;
+    }
+    if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES) {
+        PyErr_SetString(PyExc_BufferError, "scan results are strided");
+        return -1;
+    }
+    view->buf = (void *)self->results->data();
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->len = self->shape[0] * 2 * sizeof(int);
+    view->readonly = 1;
+    view->itemsize = sizeof(int);
+    view->format = (flags & PyBUF_FORMAT) ? (char *)"i" : nullptr;
+    view->ndim = 2;
+    view->shape = self->shape;
+    view->strides = self->strides;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    return 0;
+}
+
+static PyBufferProcs resultsBuffer = {(getbufferproc)resultsGetBuffer, nullptr};
+
+static Py_ssize_t resultsLength(PyResults *self) {
+    return self->shape[0];
+}
+
+static PySequenceMethods resultsSequence = {(lenfunc)resultsLength};
+
+static int worldInit(PyWorld *self, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"seed", "prune_octaves", nullptr};
+    long long seed;
+    int pruneOctaves = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "L|p", (char **)keywords, &seed, &pruneOctaves)) {
+        return -1;
+    }
+    if (self->world == nullptr) {
+        self->world = new World((uint64_t)seed);
+        self->lock = new std::mutex;
+    }
+    // __init__ called again, the chunks of the previous seed must not answer for the new one
+    std::lock_guard<std::mutex> guard(*self->lock);
+    free_world(*self->world);
+    self->world->seed = canonicalSeed((uint64_t)seed);
+    self->world->prune_octaves = pruneOctaves;
+    return 0;
+}
+
+static void worldDealloc(PyWorld *self) {
+    delete self->world;
+    delete self->lock;
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static bool worldReady(PyWorld *self) {
+    if (self->world == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "World.__init__ was not called");
+        return false;
+    }
+    return true;
+}
+
+static PyObject *worldChunkHasDungeon(PyWorld *self, PyObject *args) {
+    int chunkX, chunkZ;
+    if (!worldReady(self) || !PyArg_ParseTuple(args, "ii", &chunkX, &chunkZ)) {
+        return nullptr;
+    }
+    DungeonResult result;
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> guard(*self->lock);
+        result = chunkHasDungeon(self->world, chunkX, chunkZ);
+    }
+    Py_END_ALLOW_THREADS
+    if (!result.has_dungeon) {
+        Py_RETURN_NONE;
+    }
+    return Py_BuildValue("(ii)", result.x, result.z);
+}
+
+static PyObject *worldScanRegion(PyWorld *self, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"min_chunk_x", "min_chunk_z", "max_chunk_x", "max_chunk_z", "threads", nullptr};
+    int minChunkX, minChunkZ, maxChunkX, maxChunkZ, threads = 1;
+    if (!worldReady(self) || !PyArg_ParseTupleAndKeywords(args, kwargs, "iiii|i", (char **)keywords, &minChunkX, &minChunkZ, &maxChunkX, &maxChunkZ, &threads)) {
+        return nullptr;
+    }
+    PyResults *results = PyObject_New(PyResults, &PyResultsType);
+    if (results == nullptr) {
+        return nullptr;
+    }
+    results->results = new std::vector<DungeonResult>;
+    // never empty storage, a buffer must point somewhere even with no dungeons
+    results->results->reserve(1);
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> guard(*self->lock);
+        if (threads > 1) {
+            scanRegionParallel(self->world, minChunkX, minChunkZ, maxChunkX, maxChunkZ, threads, results->results);
+        } else {
+            scanRegion(self->world, minChunkX, minChunkZ, maxChunkX, maxChunkZ, results->results);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    results->shape[0] = (Py_ssize_t)results->results->size();
+    results->shape[1] = 2;
+    results->strides[0] = sizeof(DungeonResult);
+    results->strides[1] = sizeof(int);
+    return (PyObject *)results;
+}
+
+static PyObject *worldChunkBlocks(PyWorld *self, PyObject *args) {
+    int chunkX, chunkZ;
+    if (!worldReady(self) || !PyArg_ParseTuple(args, "ii", &chunkX, &chunkZ)) {
+        return nullptr;
+    }
+    PyBlocks *blocks = PyObject_New(PyBlocks, &PyBlocksType);
+    if (blocks == nullptr) {
+        return nullptr;
+    }
+    // a fresh buffer the array owns, the world's own chunks come and go with its checks
+    Chunk chunk;
+    Py_BEGIN_ALLOW_THREADS
+    uint64_t seed;
+    bool pruneOctaves;
+    {
+        // taken like the scans so a concurrent __init__ can't change the settings half way through reading them
+        std::lock_guard<std::mutex> guard(*self->lock);
+        seed = self->world->seed;
+        pruneOctaves = self->world->prune_octaves;
+    }
+    chunk = TerrainWrapper(seed, chunkX, chunkZ, pruneOctaves);
+    Py_END_ALLOW_THREADS
+    blocks->blocks = chunk.blocks;
+    blocks->shape[0] = 16;
+    blocks->shape[1] = 16;
+    blocks->shape[2] = 128;
+    blocks->strides[0] = 16 * 128;
+    blocks->strides[1] = 128;
+    blocks->strides[2] = 1;
+    return (PyObject *)blocks;
+}
+
+static PyObject *worldFree(PyWorld *self, PyObject *) {
+    if (!worldReady(self)) {
+        return nullptr;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> guard(*self->lock);
+        free_world(*self->world);
+    }
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static PyObject *worldSeed(PyWorld *self, void *) {
+    if (!worldReady(self)) {
+        return nullptr;
+    }
+    return PyLong_FromUnsignedLongLong(self->world->seed);
+}
+
+static PyMethodDef worldMethods[] = {
+    {"chunk_has_dungeon", (PyCFunction)worldChunkHasDungeon, METH_VARARGS, "chunk_has_dungeon(chunk_x, chunk_z) -> (x, z) or None"},
+    {"scan_region", (PyCFunction)(void (*)(void))worldScanRegion, METH_VARARGS | METH_KEYWORDS, "scan_region(min_chunk_x, min_chunk_z, max_chunk_x, max_chunk_z, threads=1) -> buffer of shape (n, 2) with x, z"},
+    {"chunk_blocks", (PyCFunction)worldChunkBlocks, METH_VARARGS, "chunk_blocks(chunk_x, chunk_z) -> uint8 buffer of shape (16, 16, 128) indexed [x][z][y]"},
+    {"free", (PyCFunction)worldFree, METH_NOARGS, "drops the chunks the world has generated so far"},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+static PyGetSetDef worldGetSet[] = {
+    {"seed", (getter)worldSeed, nullptr, "world seed", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}
+};
+
+static PyModuleDef moduleDef = {PyModuleDef_HEAD_INIT, "beta_dungeons", "Minecraft Beta 1.7.3 dungeon finder", -1};
+
+PyMODINIT_FUNC PyInit_beta_dungeons(void) {
+    PyBlocksType.tp_name = "beta_dungeons.Blocks";
+    PyBlocksType.tp_basicsize = sizeof(PyBlocks);
+    PyBlocksType.tp_flags = Py_TPFLAGS_DEFAULT;
+    PyBlocksType.tp_dealloc = (destructor)blocksDealloc;
+    PyBlocksType.tp_as_buffer = &blocksBuffer;
+
+    PyResultsType.tp_name = "beta_dungeons.ScanResults";
+    PyResultsType.tp_basicsize = sizeof(PyResults);
+    PyResultsType.tp_flags = Py_TPFLAGS_DEFAULT;
+    PyResultsType.tp_dealloc = (destructor)resultsDealloc;
+    PyResultsType.tp_as_buffer = &resultsBuffer;
+    PyResultsType.tp_as_sequence = &resultsSequence;
+
+    PyWorldType.tp_name = "beta_dungeons.World";
+    PyWorldType.tp_basicsize = sizeof(PyWorld);
+    PyWorldType.tp_flags = Py_TPFLAGS_DEFAULT;
+    PyWorldType.tp_doc = "World(seed, prune_octaves=False)";
+    PyWorldType.tp_new = PyType_GenericNew;
+    PyWorldType.tp_init = (initproc)worldInit;
+    PyWorldType.tp_dealloc = (destructor)worldDealloc;
+    PyWorldType.tp_methods = worldMethods;
+    PyWorldType.tp_getset = worldGetSet;
+
+    if (PyType_Ready(&PyBlocksType) < 0 || PyType_Ready(&PyResultsType) < 0 || PyType_Ready(&PyWorldType) < 0) {
+        return nullptr;
+    }
+    PyObject *module = PyModule_Create(&moduleDef);
+    if (module == nullptr) {
+        return nullptr;
+    }
+    Py_INCREF(&PyWorldType);
+    if (PyModule_AddObject(module, "World", (PyObject *)&PyWorldType) < 0) {
+        Py_DECREF(&PyWorldType);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    return module;
+}
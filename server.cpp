@@ -0,0 +1,16 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "src/beta_dungeons.hpp"
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s socket [seeds kept warm] [chunks per seed]\n", argv[0]);
+        return 1;
+    }
+    QueryServerConfig config = {argv[1], argc > 2 ? atoi(argv[2]) : 8, argc > 3 ? (size_t)atol(argv[3]) : 4096, true};
+    if (!runQueryServer(&config)) {
+        perror("server");
+        return 1;
+    }
+}
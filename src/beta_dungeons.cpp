@@ -4,6 +4,7 @@
 #include <fstream>
 #include <algorithm>
 #include <memory.h>
+#include <math.h>
 
 #include "rng.h"
 #include "beta_dungeons.hpp"
@@ -50,11 +51,14 @@ inline uint64_t random_next_long(Random *random) {
     return (((uint64_t) random_next(random, 32)) << 32u) + (int32_t) random_next(random, 32);
 }
 
-struct PermutationTable {
+// Cache line aligned with the permutations first, so an octave's hot bytes start a line and the offsets, which are
+// only read once per coordinate, sit in a line of their own after them.
+struct alignas(64) PermutationTable {
+    // doubled like Java's, any index up to 511 can be looked up without wrapping it
+    uint8_t permutations[512];
     double xo;
     double yo;
     double zo; // this actually never used in fixed noise aka 2d noise;)
-    uint8_t permutations[256];
 };
 
 static inline void initOctaves(PermutationTable octaves[], Random *random, int nbOctaves) {
@@ -70,13 +74,12 @@ static inline void initOctaves(PermutationTable octaves[], Random *random, int n
         uint8_t index = 0;
         do {
             uint32_t randomIndex = (uint32_t) random_next_int(random, 256u - index) + index;
-            if (randomIndex != index) {
-                // swap
-                permutations[index] ^= permutations[randomIndex];
-                permutations[randomIndex] ^= permutations[index];
-                permutations[index] ^= permutations[randomIndex];
-            }
+            // a plain swap, an xor swap chains three stores and reloads of the same bytes through every step
+            uint8_t kept = permutations[index];
+            permutations[index] = permutations[randomIndex];
+            permutations[randomIndex] = kept;
         } while (index++ != 255);
+        memcpy(permutations + 256, permutations, 256);
     }
 }
 
@@ -158,9 +161,9 @@ int grad2[12][2] = {{1,  1,},
                     {0,  -1,}};
 
 
-static inline void simplexNoise(double **buffer, double chunkX, double chunkZ, int x, int z, double offsetX, double offsetZ, double octaveFactor, PermutationTable permutationTable) {
+static inline void simplexNoise(double **buffer, double chunkX, double chunkZ, int x, int z, double offsetX, double offsetZ, double octaveFactor, const PermutationTable &permutationTable) {
     int k = 0;
-    uint8_t *permutations = permutationTable.permutations;
+    const uint8_t *permutations = permutationTable.permutations;
     for (int X = 0; X < x; X++) {
         double XCoords = (chunkX + (double) X) * offsetX + permutationTable.xo;
         for (int Z = 0; Z < z; Z++) {
@@ -196,9 +199,9 @@ static inline void simplexNoise(double **buffer, double chunkX, double chunkZ, i
             // Work out the hashed gradient indices of the three simplex corners
             uint8_t ii = (uint8_t) xHairy & 0xffu;
             uint8_t jj = (uint8_t) zHairy & 0xffu;
-            uint8_t gi0 = permutations[(uint8_t) (ii + permutations[jj]) & 0xffu] % 12u;
-            uint8_t gi1 = permutations[(uint8_t) (ii + offsetSecondCornerX + permutations[(uint8_t) (jj + offsetSecondCornerZ) & 0xffu]) & 0xffu] % 12u;
-            uint8_t gi2 = permutations[(uint8_t) (ii + 1 + permutations[(uint8_t) (jj + 1) & 0xffu]) & 0xffu] % 12u;
+            uint8_t gi0 = permutations[ii + permutations[jj]] % 12u;
+            uint8_t gi1 = permutations[ii + offsetSecondCornerX + permutations[jj + offsetSecondCornerZ]] % 12u;
+            uint8_t gi2 = permutations[ii + 1 + permutations[jj + 1]] % 12u;
 
             // Calculate the contribution from the three corners
             double t0 = 0.5 - x0 * x0 - y0 * y0;
@@ -236,7 +239,7 @@ static inline void simplexNoise(double **buffer, double chunkX, double chunkZ, i
 }
 
 
-static inline void getFixedNoise(double *buffer, double chunkX, double chunkZ, int sizeX, int sizeZ, double offsetX, double offsetZ, double ampFactor, PermutationTable *permutationTable, uint8_t octaves) {
+static inline void getFixedNoise(double *buffer, double chunkX, double chunkZ, int sizeX, int sizeZ, double offsetX, double offsetZ, double ampFactor, const PermutationTable *permutationTable, uint8_t octaves) {
     offsetX /= 1.5;
     offsetZ /= 1.5;
     // cache should be created by the caller
@@ -253,8 +256,7 @@ static inline void getFixedNoise(double *buffer, double chunkX, double chunkZ, i
 }
 
 
-static inline BiomeNoises *initBiomeGen(uint64_t worldSeed) {
-    auto *pBiomeNoises = new BiomeNoises;
+static inline void initBiomeGen(BiomeNoises *pBiomeNoises, uint64_t worldSeed) {
     Random worldRandom;
     PermutationTable *octaves;
     worldRandom = get_random(worldSeed * 9871L);
@@ -266,11 +268,10 @@ static inline BiomeNoises *initBiomeGen(uint64_t worldSeed) {
     worldRandom = get_random(worldSeed * 543321L);
     octaves = pBiomeNoises->precipitationOctaves;
     initOctaves(octaves, &worldRandom, 2);
-    return pBiomeNoises;
 }
 
 
-static inline BiomeResult *getBiomes(int posX, int posZ, int sizeX, int sizeZ, BiomeNoises *biomesOctaves) {
+static inline BiomeResult *getBiomes(int posX, int posZ, int sizeX, int sizeZ, const BiomeNoises *biomesOctaves) {
     auto *biomes = new Biomes[16 * 16];
     auto *biomeResult = new BiomeResult;
     auto *temperature = new double[sizeX * sizeZ];
@@ -319,12 +320,87 @@ void delete_biome_result(BiomeResult *biomeResult) {
 }
 
 BiomeResult *BiomeWrapper(uint64_t worldSeed, int32_t chunkX, int32_t chunkZ) {
-    BiomeNoises *biomesOctaves = initBiomeGen(worldSeed);
+    auto *biomesOctaves = new BiomeNoises;
+    initBiomeGen(biomesOctaves, worldSeed);
     auto *biomes = getBiomes(chunkX * 16, chunkZ * 16, 16, 16, biomesOctaves);
     delete biomesOctaves;
     return biomes;
 }
 
+// Climate of one chunk evaluated only at the columns the terrain stage asks for, each column runs its
+// simplex octaves at most once. Values are bit-identical to the matching entries of getBiomes.
+struct ClimateSampler {
+    const BiomeNoises *noises;
+    int posX, posZ;
+    double temperature[16 * 16];
+    double humidity[16 * 16];
+    double precipitation[16 * 16];
+    uint8_t known[16 * 16];
+};
+
+enum ClimateKnown {
+    CLIMATE_PRECIPITATION = 1,
+    CLIMATE_TEMPERATURE = 2,
+    CLIMATE_HUMIDITY = 4
+};
+
+static inline void initClimateSampler(ClimateSampler *climate, const BiomeNoises *biomesOctaves, int posX, int posZ) {
+    climate->noises = biomesOctaves;
+    climate->posX = posX;
+    climate->posZ = posZ;
+    memset(climate->known, 0, sizeof(climate->known));
+}
+
+static inline double climatePrecipitation(ClimateSampler *climate, int X, int Z) {
+    int index = X * 16 + Z;
+    if (!(climate->known[index] & CLIMATE_PRECIPITATION)) {
+        double precipitation;
+        getFixedNoise(&precipitation, climate->posX + X, climate->posZ + Z, 1, 1, 0.25, 0.25, 0.58823529411764708, climate->noises->precipitationOctaves, 2);
+        climate->precipitation[index] = precipitation * 1.1000000000000001 + 0.5;
+        climate->known[index] |= CLIMATE_PRECIPITATION;
+    }
+    return climate->precipitation[index];
+}
+
+static inline double climateTemperature(ClimateSampler *climate, int X, int Z) {
+    int index = X * 16 + Z;
+    if (!(climate->known[index] & CLIMATE_TEMPERATURE)) {
+        double preci = climatePrecipitation(climate, X, Z);
+        double temperature;
+        getFixedNoise(&temperature, climate->posX + X, climate->posZ + Z, 1, 1, 0.02500000037252903, 0.02500000037252903, 0.25, climate->noises->temperatureOctaves, 4);
+        double temp = (temperature * 0.14999999999999999 + 0.69999999999999996) * (1.0 - 0.01) + preci * 0.01;
+        temp = 1.0 - (1.0 - temp) * (1.0 - temp);
+        if (temp < 0.0) {
+            temp = 0.0;
+        }
+        if (temp > 1.0) {
+            temp = 1.0;
+        }
+        climate->temperature[index] = temp;
+        climate->known[index] |= CLIMATE_TEMPERATURE;
+    }
+    return climate->temperature[index];
+}
+
+static inline double climateHumidity(ClimateSampler *climate, int X, int Z) {
+    int index = X * 16 + Z;
+    if (!(climate->known[index] & CLIMATE_HUMIDITY)) {
+        double preci = climatePrecipitation(climate, X, Z);
+        double humidity;
+        getFixedNoise(&humidity, climate->posX + X, climate->posZ + Z, 1, 1, 0.05000000074505806, 0.05000000074505806, 0.33333333333333331, climate->noises->humidityOctaves, 4);
+        double humi = (humidity * 0.14999999999999999 + 0.5) * (1.0 - 0.002) + preci * 0.002;
+        if (humi < 0.0) {
+            humi = 0.0;
+        }
+        if (humi > 1.0) {
+            humi = 1.0;
+        }
+        climate->humidity[index] = humi;
+        climate->known[index] |= CLIMATE_HUMIDITY;
+    }
+    return climate->humidity[index];
+}
+
 static inline double lerp(double x, double a, double b) {
     return a + x * (b - a);
 }
@@ -373,8 +449,8 @@ static inline double grad2D(uint8_t hash, double x, double z) {
 }
 
 //we care only about 60-61, 77-78, 145-146, 162-163, 230-231, 247-248, 315-316, 332-333, 400-401, 417-418
-static inline void generatePermutations(double **buffer, double x, double y, double z, double noiseFactorX, double noiseFactorY, double noiseFactorZ, double octaveSize, PermutationTable permutationTable) {
-    uint8_t *permutations = permutationTable.permutations;
+static inline void generatePermutations(double **buffer, double x, double y, double z, double noiseFactorX, double noiseFactorY, double noiseFactorZ, double octaveSize, const PermutationTable &permutationTable) {
+    const uint8_t *permutations = permutationTable.permutations;
     double octaveWidth = 1.0 / octaveSize;
     int32_t i2 = -1;
     double x1 = 0.0;
@@ -423,14 +499,14 @@ static inline void generatePermutations(double **buffer, double x, double y, dou
 
             if (Y == 0 || yBottoms != i2) { // this is wrong on so many levels, same ybottoms doesnt mean x and z were the same...
                 i2 = yBottoms;
-                uint16_t k2 = permutations[(uint8_t)((uint16_t)(permutations[(uint8_t)(xBottoms& 0xffu)] + yBottoms)& 0xffu)] + zBottoms;
-                uint16_t l2 = permutations[(uint8_t)((uint16_t)(permutations[(uint8_t)(xBottoms& 0xffu)] + yBottoms + 1)& 0xffu)] + zBottoms;
-                uint16_t k3 = permutations[(uint8_t)((uint16_t)(permutations[(uint8_t)((xBottoms + 1u)& 0xffu)] + yBottoms)& 0xffu)] + zBottoms;
-                uint16_t l3 = permutations[(uint8_t)((uint16_t)(permutations[(uint8_t)((xBottoms + 1u)& 0xffu)] + yBottoms + 1)& 0xffu)] + zBottoms;
-                x1 = lerp(fadeX, grad(permutations[(uint8_t)(k2& 0xffu)], xCoord, yCoords, zCoord), grad(permutations[(uint8_t)(k3& 0xffu)], xCoord - 1.0, yCoords, zCoord));
-                x2 = lerp(fadeX, grad(permutations[(uint8_t)(l2& 0xffu)], xCoord, yCoords - 1.0, zCoord), grad(permutations[(uint8_t)(l3& 0xffu)], xCoord - 1.0, yCoords - 1.0, zCoord));
-                xx1 = lerp(fadeX, grad(permutations[(uint8_t)((k2+1u)& 0xffu)], xCoord, yCoords, zCoord - 1.0), grad(permutations[(uint8_t)((k3+1u)& 0xffu)], xCoord - 1.0, yCoords, zCoord - 1.0));
-                xx2 = lerp(fadeX, grad(permutations[(uint8_t)((l2+1u)& 0xffu)], xCoord, yCoords - 1.0, zCoord - 1.0), grad(permutations[(uint8_t)((l3+1u)& 0xffu)], xCoord - 1.0, yCoords - 1.0, zCoord - 1.0));
+                uint16_t k2 = permutations[permutations[xBottoms] + yBottoms] + zBottoms;
+                uint16_t l2 = permutations[permutations[xBottoms] + yBottoms + 1] + zBottoms;
+                uint16_t k3 = permutations[permutations[xBottoms + 1] + yBottoms] + zBottoms;
+                uint16_t l3 = permutations[permutations[xBottoms + 1] + yBottoms + 1] + zBottoms;
+                x1 = lerp(fadeX, grad(permutations[k2], xCoord, yCoords, zCoord), grad(permutations[k3], xCoord - 1.0, yCoords, zCoord));
+                x2 = lerp(fadeX, grad(permutations[l2], xCoord, yCoords - 1.0, zCoord), grad(permutations[l3], xCoord - 1.0, yCoords - 1.0, zCoord));
+                xx1 = lerp(fadeX, grad(permutations[k2 + 1], xCoord, yCoords, zCoord - 1.0), grad(permutations[k3 + 1], xCoord - 1.0, yCoords, zCoord - 1.0));
+                xx2 = lerp(fadeX, grad(permutations[l2 + 1], xCoord, yCoords - 1.0, zCoord - 1.0), grad(permutations[l3 + 1], xCoord - 1.0, yCoords - 1.0, zCoord - 1.0));
             }
             double y1 = lerp(fadeY, x1, x2);
             double y2 = lerp(fadeY, xx1, xx2);
@@ -440,9 +516,9 @@ static inline void generatePermutations(double **buffer, double x, double y, dou
     }
 }
 
-static inline void generateFixedPermutations(double **buffer, double x, double z, int sizeX, int sizeZ, double noiseFactorX, double noiseFactorZ, double octaveSize, PermutationTable permutationTable) {
+static inline void generateFixedPermutations(double **buffer, double x, double z, int sizeX, int sizeZ, double noiseFactorX, double noiseFactorZ, double octaveSize, const PermutationTable &permutationTable) {
     int index = 0;
-    uint8_t *permutations = permutationTable.permutations;
+    const uint8_t *permutations = permutationTable.permutations;
     double octaveWidth = 1.0 / octaveSize;
     for (int X = 0; X < sizeX; X++) {
         double xCoord = (x + (double) X) * noiseFactorX + permutationTable.xo;
@@ -462,12 +538,12 @@ static inline void generateFixedPermutations(double **buffer, double x, double z
             auto zBottoms = (uint16_t) ((uint32_t) clampedZCoord & 0xffu);
             zCoord -= clampedZCoord;
             double fadeZ = zCoord * zCoord * zCoord * (zCoord * (zCoord * 6.0 - 15.0) + 10.0);
-            uint16_t hhxz = ((permutations[permutations[xBottoms] & 0xffu] & 0xffu) + zBottoms) & 0xffu;
-            uint16_t hhx1z = ((permutations[permutations[(xBottoms + 1u) & 0xffu] & 0xffu] & 0xffu) + zBottoms) & 0xffu;
-            uint16_t Hhhxz = permutations[hhxz & 0xffu];
-            uint16_t Hhhx1z = permutations[hhx1z & 0xffu];
-            uint16_t Hhhxz1 = permutations[(hhxz + 1u) & 0xffu];
-            uint16_t Hhhx1z1 = permutations[(hhx1z + 1u) & 0xffu];
+            uint16_t hhxz = permutations[permutations[xBottoms]] + zBottoms;
+            uint16_t hhx1z = permutations[permutations[xBottoms + 1]] + zBottoms;
+            uint16_t Hhhxz = permutations[hhxz];
+            uint16_t Hhhx1z = permutations[hhx1z];
+            uint16_t Hhhxz1 = permutations[hhxz + 1];
+            uint16_t Hhhx1z1 = permutations[hhx1z + 1];
             double x1 = lerp(fadeX, grad2D(Hhhxz, xCoord, zCoord), grad2D(Hhhx1z, xCoord - 1.0, zCoord));
             double x2 = lerp(fadeX, grad2D(Hhhxz1, xCoord, zCoord - 1.0), grad2D(Hhhx1z1, xCoord - 1.0, zCoord - 1.0));
             double y1 = lerp(fadeZ, x1, x2);
@@ -477,14 +553,18 @@ static inline void generateFixedPermutations(double **buffer, double x, double z
     }
 }
 
-static inline void generateNormalPermutations(double **buffer, double x, double y, double z, int sizeX, int sizeY, int sizeZ, double noiseFactorX, double noiseFactorY, double noiseFactorZ, double octaveSize, PermutationTable permutationTable) {
-    uint8_t *permutations = permutationTable.permutations;
+// mask (optional) selects which samples of the sizeX*sizeZ*sizeY block are evaluated, the others are left untouched.
+// The gradient cache is still keyed on the first Y of every yBottoms run so masked samples get bit-identical values.
+static inline void generateNormalPermutations(double **buffer, double x, double y, double z, int sizeX, int sizeY, int sizeZ, double noiseFactorX, double noiseFactorY, double noiseFactorZ, double octaveSize, const PermutationTable &permutationTable, const uint8_t *mask = nullptr) {
+    const uint8_t *permutations = permutationTable.permutations;
     double octaveWidth = 1.0 / octaveSize;
     int32_t i2 = -1;
     double x1 = 0.0;
     double x2 = 0.0;
     double xx1 = 0.0;
     double xx2 = 0.0;
+    double cachedYCoords = 0.0;
+    bool stale = false;
     double t;
     double w;
     int columnIndex = 0;
@@ -525,14 +605,24 @@ static inline void generateNormalPermutations(double **buffer, double x, double
 
                 if (Y == 0 || yBottoms != i2) { // this is wrong on so many levels, same ybottoms doesnt mean x and z were the same...
                     i2 = yBottoms;
-                    uint16_t k2 = permutations[(uint8_t)((uint16_t)(permutations[(uint8_t)(xBottoms& 0xffu)] + yBottoms)& 0xffu)] + zBottoms;
-                    uint16_t l2 = permutations[(uint8_t)((uint16_t)(permutations[(uint8_t)(xBottoms& 0xffu)] + yBottoms + 1u )& 0xffu)] + zBottoms;
-                    uint16_t k3 = permutations[(uint8_t)((uint16_t)(permutations[(uint8_t)((xBottoms + 1u)& 0xffu)] + yBottoms )& 0xffu)] + zBottoms;
-                    uint16_t l3 = permutations[(uint8_t)((uint16_t)(permutations[(uint8_t)((xBottoms + 1u)& 0xffu)] + yBottoms + 1u) & 0xffu)] + zBottoms;
-                    x1 = lerp(fadeX, grad(permutations[(uint8_t)(k2& 0xffu)], xCoord, yCoords, zCoord), grad(permutations[(uint8_t)(k3& 0xffu)], xCoord - 1.0, yCoords, zCoord));
-                    x2 = lerp(fadeX, grad(permutations[(uint8_t)(l2& 0xffu)], xCoord, yCoords - 1.0, zCoord), grad(permutations[(uint8_t)(l3& 0xffu)], xCoord - 1.0, yCoords - 1.0, zCoord));
-                    xx1 = lerp(fadeX, grad(permutations[(uint8_t)((k2+1u)& 0xffu)], xCoord, yCoords, zCoord - 1.0), grad(permutations[(uint8_t)((k3+1u)& 0xffu)], xCoord - 1.0, yCoords, zCoord - 1.0));
-                    xx2 = lerp(fadeX, grad(permutations[(uint8_t)((l2+1u)& 0xffu)], xCoord, yCoords - 1.0, zCoord - 1.0), grad(permutations[(uint8_t)((l3+1u)& 0xffu)], xCoord - 1.0, yCoords - 1.0, zCoord - 1.0));
+                    cachedYCoords = yCoords;
+                    stale = true;
+                }
+                if (mask && !mask[columnIndex]) {
+                    columnIndex++;
+                    continue;
+                }
+                if (stale) {
+                    stale = false;
+                    double yc = cachedYCoords;
+                    uint16_t k2 = permutations[permutations[xBottoms] + i2] + zBottoms;
+                    uint16_t l2 = permutations[permutations[xBottoms] + i2 + 1] + zBottoms;
+                    uint16_t k3 = permutations[permutations[xBottoms + 1] + i2] + zBottoms;
+                    uint16_t l3 = permutations[permutations[xBottoms + 1] + i2 + 1] + zBottoms;
+                    x1 = lerp(fadeX, grad(permutations[k2], xCoord, yc, zCoord), grad(permutations[k3], xCoord - 1.0, yc, zCoord));
+                    x2 = lerp(fadeX, grad(permutations[l2], xCoord, yc - 1.0, zCoord), grad(permutations[l3], xCoord - 1.0, yc - 1.0, zCoord));
+                    xx1 = lerp(fadeX, grad(permutations[k2 + 1], xCoord, yc, zCoord - 1.0), grad(permutations[k3 + 1], xCoord - 1.0, yc, zCoord - 1.0));
+                    xx2 = lerp(fadeX, grad(permutations[l2 + 1], xCoord, yc - 1.0, zCoord - 1.0), grad(permutations[l3 + 1], xCoord - 1.0, yc - 1.0, zCoord - 1.0));
                 }
                 double y1 = lerp(fadeY, x1, x2);
                 double y2 = lerp(fadeY, xx1, xx2);
@@ -544,7 +634,7 @@ static inline void generateNormalPermutations(double **buffer, double x, double
 }
 
 
-static inline void generateNoise(double *buffer, double chunkX, double chunkY, double chunkZ, int sizeX, int sizeY, int sizeZ, double offsetX, double offsetY, double offsetZ, PermutationTable *permutationTable, int nbOctaves, int type) {
+static inline void generateNoise(double *buffer, double chunkX, double chunkY, double chunkZ, int sizeX, int sizeY, int sizeZ, double offsetX, double offsetY, double offsetZ, const PermutationTable *permutationTable, int nbOctaves, int type) {
     memset(buffer, 0, sizeof(double) * sizeX * sizeZ * sizeY);
     double octavesFactor = 1.0;
     for (int octave = 0; octave < nbOctaves; octave++) {
@@ -553,7 +643,7 @@ static inline void generateNoise(double *buffer, double chunkX, double chunkY, d
     }
 }
 
-static inline void generateFixedNoise(double *buffer, double chunkX, double chunkZ, int sizeX, int sizeZ, double offsetX, double offsetZ, PermutationTable *permutationTable, int nbOctaves) {
+static inline void generateFixedNoise(double *buffer, double chunkX, double chunkZ, int sizeX, int sizeZ, double offsetX, double offsetZ, const PermutationTable *permutationTable, int nbOctaves) {
     memset(buffer, 0, sizeof(double) * sizeX * sizeZ);
     double octavesFactor = 1.0;
     for (int octave = 0; octave < nbOctaves; octave++) {
@@ -563,7 +653,225 @@ static inline void generateFixedNoise(double *buffer, double chunkX, double chun
 }
 
 
-static inline void fillNoiseColumn(double **NoiseColumn, int chunkX, int chunkZ, const double *temperature, const double *humidity, TerrainNoises terrainNoises) {
+// cell classification produced by the exact-sign mode of fillNoiseColumn, one entry per 4x8x4 interpolation cell
+enum CellSign {
+    CELL_MIXED, // corners may straddle zero, interpolate the exact densities
+    CELL_SOLID, // every corner is provably > 0 so the whole cell is stone
+    CELL_EMPTY  // every corner is provably < 0 so the cell holds no stone
+};
+
+// a single perlin octave is a trilinear blend of grad() values which are sums of two coordinates in [-1, 1]
+#define OCTAVE_BOUND 2.0
+// keeps a decided sign far above the rounding of the partial sums and of the interpolation in generateTerrain
+#define DENSITY_SIGN_MARGIN 1e-6
+
+static inline double columnDensity(int var33, double var27, double var31, double minNoise, double maxNoise, double mainNoise) {
+    int var6 = 17;
+    double var34 = 0.0D;
+    double var36 = ((double)var33 - var31) * 12.0D / var27;
+    if(var36 < 0.0D) {
+        var36 *= 4.0D;
+    }
+
+    double var38 = minNoise / 512.0D;
+    double var40 = maxNoise / 512.0D;
+    double var42 = (mainNoise / 10.0D + 1.0D) / 2.0D;
+    if(var42 < 0.0D) {
+        var34 = var38;
+    } else if(var42 > 1.0D) {
+        var34 = var40;
+    } else {
+        var34 = var38 + (var40 - var38) * var42;
+    }
+
+    var34 -= var36;
+    if(var33 > var6 - 4) {
+        double var44 = (double)((float)(var33 - (var6 - 4)) / 3.0F);
+        var34 = var34 * (1.0D - var44) + -10.0D * var44;
+    }
+    return var34;
+}
+
+// returns +1/-1 once the density is provably positive/negative whatever the main limit noise, 0 otherwise
+static inline int columnDensitySign(int var33, double var27, double var31, double minLo, double minHi, double maxLo, double maxHi) {
+    int var6 = 17;
+    double var36 = ((double)var33 - var31) * 12.0D / var27;
+    if(var36 < 0.0D) {
+        var36 *= 4.0D;
+    }
+    // the blend by the main limit noise always lands between the min and max limits
+    double lo = (minLo < maxLo ? minLo : maxLo) / 512.0D - var36;
+    double hi = (minHi > maxHi ? minHi : maxHi) / 512.0D - var36;
+    if(var33 > var6 - 4) {
+        double var44 = (double)((float)(var33 - (var6 - 4)) / 3.0F);
+        lo = lo * (1.0D - var44) + -10.0D * var44;
+        hi = hi * (1.0D - var44) + -10.0D * var44;
+    }
+    if (lo > DENSITY_SIGN_MARGIN) return 1;
+    if (hi < -DENSITY_SIGN_MARGIN) return -1;
+    return 0;
+}
+
+// past this the int32 floors of the finest octave overflow and the octave bound no longer holds
+static inline bool exactSignInRange(int chunkX, int chunkZ) {
+    double limit = 2147483647.0 - 256.0;
+    return (fabs((double)chunkX) + 5.0) * 684.41200000000003 < limit && (fabs((double)chunkZ) + 5.0) * 684.41200000000003 < limit;
+}
+
+// Evaluates the min/max limit octaves from the coarsest (largest amplitude) down and stops per sample as soon
+// as the remaining octaves cannot flip the sign of the density. Only corners of cells whose sign is still open
+// get their remaining octaves and the main limit noise, summed in the original order so the values are exact.
+static inline void fillNoiseColumnExactSign(double *noiseColumn, uint8_t *cellSigns, int chunkX, int chunkZ, const double *var27s, const double *var31s, const TerrainNoises &terrainNoises) {
+    double d = 684.41200000000003;
+    double d1 = 684.41200000000003;
+    auto *minOctaves = new double[16 * 425];
+    auto *maxOctaves = new double[16 * 425];
+    double minSum[425], maxSum[425];
+    int8_t sign[425];
+    uint8_t lowestOctave[425];
+    uint8_t active[425];
+    uint8_t needed[425];
+
+    double remaining = 0.0;
+    for (int octave = 0; octave < 16; octave++) {
+        remaining += OCTAVE_BOUND * ldexp(1.0, octave);
+    }
+    for (int i = 0; i < 425; i++) {
+        minSum[i] = 0.0;
+        maxSum[i] = 0.0;
+        lowestOctave[i] = 16;
+        sign[i] = (int8_t)columnDensitySign(i % 17, var27s[i / 17], var31s[i / 17], -remaining, remaining, -remaining, remaining);
+        active[i] = sign[i] == 0;
+    }
+
+    for (int octave = 15; octave >= 0; octave--) {
+        double octavesFactor = ldexp(1.0, -octave);
+        remaining -= OCTAVE_BOUND * ldexp(1.0, octave);
+        double *minBuffer = minOctaves + octave * 425;
+        double *maxBuffer = maxOctaves + octave * 425;
+        memset(minBuffer, 0, sizeof(double) * 425);
+        memset(maxBuffer, 0, sizeof(double) * 425);
+        if (memchr(active, 1, sizeof(active)) == nullptr) continue;
+        generateNormalPermutations(&minBuffer, chunkX, 0, chunkZ, 5, 17, 5, d * octavesFactor, d1 * octavesFactor, d * octavesFactor, octavesFactor, terrainNoises.minLimit[octave], active);
+        generateNormalPermutations(&maxBuffer, chunkX, 0, chunkZ, 5, 17, 5, d * octavesFactor, d1 * octavesFactor, d * octavesFactor, octavesFactor, terrainNoises.maxLimit[octave], active);
+        for (int i = 0; i < 425; i++) {
+            if (!active[i]) continue;
+            minSum[i] += minBuffer[i];
+            maxSum[i] += maxBuffer[i];
+            lowestOctave[i] = (uint8_t)octave;
+            sign[i] = (int8_t)columnDensitySign(i % 17, var27s[i / 17], var31s[i / 17], minSum[i] - remaining, minSum[i] + remaining, maxSum[i] - remaining, maxSum[i] + remaining);
+            active[i] = sign[i] == 0;
+        }
+    }
+
+    memset(needed, 0, sizeof(needed));
+    for (int cellX = 0; cellX < 4; cellX++) {
+        for (int cellZ = 0; cellZ < 4; cellZ++) {
+            for (int cellY = 0; cellY < 16; cellY++) {
+                int corners[8] = {
+                    ((cellX + 0) * 5 + cellZ + 0) * 17 + cellY, ((cellX + 0) * 5 + cellZ + 1) * 17 + cellY,
+                    ((cellX + 1) * 5 + cellZ + 0) * 17 + cellY, ((cellX + 1) * 5 + cellZ + 1) * 17 + cellY,
+                    ((cellX + 0) * 5 + cellZ + 0) * 17 + cellY + 1, ((cellX + 0) * 5 + cellZ + 1) * 17 + cellY + 1,
+                    ((cellX + 1) * 5 + cellZ + 0) * 17 + cellY + 1, ((cellX + 1) * 5 + cellZ + 1) * 17 + cellY + 1
+                };
+                int total = 0;
+                for (int corner : corners) {
+                    total += sign[corner];
+                }
+                uint8_t cellSign = total == 8 ? CELL_SOLID : total == -8 ? CELL_EMPTY : CELL_MIXED;
+                cellSigns[(cellX * 4 + cellZ) * 16 + cellY] = cellSign;
+                if (cellSign == CELL_MIXED) {
+                    for (int corner : corners) {
+                        needed[corner] = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int octave = 15; octave >= 0; octave--) {
+        double octavesFactor = ldexp(1.0, -octave);
+        double *minBuffer = minOctaves + octave * 425;
+        double *maxBuffer = maxOctaves + octave * 425;
+        for (int i = 0; i < 425; i++) {
+            active[i] = needed[i] && lowestOctave[i] > octave;
+        }
+        generateNormalPermutations(&minBuffer, chunkX, 0, chunkZ, 5, 17, 5, d * octavesFactor, d1 * octavesFactor, d * octavesFactor, octavesFactor, terrainNoises.minLimit[octave], active);
+        generateNormalPermutations(&maxBuffer, chunkX, 0, chunkZ, 5, 17, 5, d * octavesFactor, d1 * octavesFactor, d * octavesFactor, octavesFactor, terrainNoises.maxLimit[octave], active);
+    }
+
+    auto *mainLimitPerlinNoise = new double[425];
+    memset(mainLimitPerlinNoise, 0, sizeof(double) * 425);
+    double octavesFactor = 1.0;
+    for (int octave = 0; octave < 8; octave++) {
+        generateNormalPermutations(&mainLimitPerlinNoise, chunkX, 0, chunkZ, 5, 17, 5, d / 80 * octavesFactor, d1 / 160 * octavesFactor, d / 80 * octavesFactor, octavesFactor, terrainNoises.mainLimit[octave], needed);
+        octavesFactor /= 2.0;
+    }
+
+    for (int i = 0; i < 425; i++) {
+        if (!needed[i]) continue;
+        double minNoise = 0.0;
+        double maxNoise = 0.0;
+        for (int octave = 0; octave < 16; octave++) {
+            minNoise = minNoise + minOctaves[octave * 425 + i];
+            maxNoise = maxNoise + maxOctaves[octave * 425 + i];
+        }
+        noiseColumn[i] = columnDensity(i % 17, var27s[i / 17], var31s[i / 17], minNoise, maxNoise, mainLimitPerlinNoise[i]);
+    }
+
+    delete[] minOctaves;
+    delete[] maxOctaves;
+    delete[] mainLimitPerlinNoise;
+}
+
+// var27 (the height scale) and var31 (the base height) of a noise column from its surface and depth noise and climate
+static inline void columnShape(double surfaceNoise, double depthNoise, double var21, double temperature, double *var27s, double *var31s) {
+    int var6 = 17;
+    double var23 = temperature * var21;
+    double var25 = 1.0D - var23;
+    var25 *= var25;
+    var25 *= var25;
+    var25 = 1.0D - var25;
+    double var27 = (surfaceNoise + 256.0D) / 512.0D;
+    var27 *= var25;
+    if(var27 > 1.0D) {
+        var27 = 1.0D;
+    }
+
+    double var29 = depthNoise / 8000.0D;
+    if(var29 < 0.0D) {
+        var29 = -var29 * 0.3D;
+    }
+
+    var29 = var29 * 3.0D - 2.0D;
+    if(var29 < 0.0D) {
+        var29 /= 2.0D;
+        if(var29 < -1.0D) {
+            var29 = -1.0D;
+        }
+
+        var29 /= 1.4D;
+        var29 /= 2.0D;
+        var27 = 0.0D;
+    } else {
+        if(var29 > 1.0D) {
+            var29 = 1.0D;
+        }
+
+        var29 /= 8.0D;
+    }
+
+    if(var27 < 0.0D) {
+        var27 = 0.0D;
+    }
+
+    var27 += 0.5D;
+    var29 = var29 * (double)var6 / 16.0D;
+    *var27s = var27;
+    *var31s = (double)var6 / 2.0D + var29 * 4.0D;
+}
+
+static inline void fillNoiseColumn(double **NoiseColumn, int chunkX, int chunkZ, ClimateSampler *climate, const TerrainNoises &terrainNoises, uint8_t *cellSigns = nullptr) {
     // we only need
     // (60, 77, 145, 162, 61, 78, 146, 163)
     // (145, 162, 230, 247, 146, 163, 231, 248)
@@ -581,183 +889,237 @@ static inline void fillNoiseColumn(double **NoiseColumn, int chunkX, int chunkZ,
     generateFixedNoise(surfaceNoise, chunkX, chunkZ, 5, 5, 1.121, 1.121, terrainNoises.scale, 10);
     generateFixedNoise(depthNoise, chunkX, chunkZ, 5, 5, 200.0, 200.0, terrainNoises.depth, 16);
 
-    auto *mainLimitPerlinNoise = new double[425];
-    auto *minLimitPerlinNoise = new double[425];
-    auto *maxLimitPerlinNoise = new double[425];
-    // use optimized noise
-    generateNoise(mainLimitPerlinNoise, chunkX, 0, chunkZ, 5, 17, 5, d / 80, d1 / 160, d / 80, terrainNoises.mainLimit, 8, 0);
-    generateNoise(minLimitPerlinNoise, chunkX, 0, chunkZ, 5, 17, 5, d, d1, d, terrainNoises.minLimit, 16, 0);
-    generateNoise(maxLimitPerlinNoise, chunkX, 0, chunkZ, 5, 17, 5, d, d1, d, terrainNoises.maxLimit, 16, 0);
-
     int var5 = 5;
     int var7 = 5;
     int var6 = 17;
 
-    int var14 = 0;
     int var15 = 0;
     int var16 = 16 / var5;
+    double var27s[25];
+    double var31s[25];
 
     for(int var17 = 0; var17 < var5; ++var17) {
         int var18 = var17 * var16 + var16 / 2;
 
         for(int var19 = 0; var19 < var7; ++var19) {
             int var20 = var19 * var16 + var16 / 2;
-            double var21 = humidity[var18 * 16 + var20];
-            double var23 = temperature[var18 * 16 + var20] * var21;
-            double var25 = 1.0D - var23;
-            var25 *= var25;
-            var25 *= var25;
-            var25 = 1.0D - var25;
-            double var27 = (surfaceNoise[var15] + 256.0D) / 512.0D;
-            var27 *= var25;
-            if(var27 > 1.0D) {
-                var27 = 1.0D;
-            }
+            double var21 = climateHumidity(climate, var18, var20);
+            columnShape(surfaceNoise[var15], depthNoise[var15], var21, climateTemperature(climate, var18, var20), &var27s[var15], &var31s[var15]);
+            ++var15;
+        }
+    }
 
-            double var29 = depthNoise[var15] / 8000.0D;
-            if(var29 < 0.0D) {
-                var29 = -var29 * 0.3D;
-            }
+    delete[] surfaceNoise;
+    delete[] depthNoise;
 
-            var29 = var29 * 3.0D - 2.0D;
-            if(var29 < 0.0D) {
-                var29 /= 2.0D;
-                if(var29 < -1.0D) {
-                    var29 = -1.0D;
-                }
+    // cellSigns is left untouched (all CELL_MIXED by the caller) when the exact-sign mode can't be used
+    if (cellSigns && exactSignInRange(chunkX, chunkZ)) {
+        fillNoiseColumnExactSign(*NoiseColumn, cellSigns, chunkX, chunkZ, var27s, var31s, terrainNoises);
+        return;
+    }
 
-                var29 /= 1.4D;
-                var29 /= 2.0D;
-                var27 = 0.0D;
-            } else {
-                if(var29 > 1.0D) {
-                    var29 = 1.0D;
-                }
+    auto *mainLimitPerlinNoise = new double[425];
+    auto *minLimitPerlinNoise = new double[425];
+    auto *maxLimitPerlinNoise = new double[425];
+    // use optimized noise
+    generateNoise(mainLimitPerlinNoise, chunkX, 0, chunkZ, 5, 17, 5, d / 80, d1 / 160, d / 80, terrainNoises.mainLimit, 8, 0);
+    generateNoise(minLimitPerlinNoise, chunkX, 0, chunkZ, 5, 17, 5, d, d1, d, terrainNoises.minLimit, 16, 0);
+    generateNoise(maxLimitPerlinNoise, chunkX, 0, chunkZ, 5, 17, 5, d, d1, d, terrainNoises.maxLimit, 16, 0);
 
-                var29 /= 8.0D;
-            }
+    int var14 = 0;
+    for(var15 = 0; var15 < var5 * var7; ++var15) {
+        for(int var33 = 0; var33 < var6; ++var33) {
+            (*NoiseColumn)[var14] = columnDensity(var33, var27s[var15], var31s[var15], minLimitPerlinNoise[var14], maxLimitPerlinNoise[var14], mainLimitPerlinNoise[var14]);
+            ++var14;
+        }
+    }
 
-            if(var27 < 0.0D) {
-                var27 = 0.0D;
-            }
+    delete[] mainLimitPerlinNoise;
+    delete[] minLimitPerlinNoise;
+    delete[] maxLimitPerlinNoise;
+}
 
-            var27 += 0.5D;
-            var29 = var29 * (double)var6 / 16.0D;
-            double var31 = (double)var6 / 2.0D + var29 * 4.0D;
-            ++var15;
+#if __GNUC__
+typedef double f64x8 __attribute__((vector_size(64)));
+typedef int64_t i64x8 __attribute__((vector_size(64)));
+typedef int8_t i8x8 __attribute__((vector_size(8)));
+typedef float f32x16 __attribute__((vector_size(64)));
+typedef int32_t i32x16 __attribute__((vector_size(64)));
+#endif
+
+// Lowest and highest y holding water in each column of a chunk (x << 4 | z), low above high when there is none, and
+// the highest of the whole chunk (-1 for none). Terrain only puts water under sea level and the caves never add or
+// remove any, so the levels taken after the terrain hold for the whole cave pass.
+struct WaterLevels {
+    uint8_t low[256];
+    uint8_t high[256];
+    int top;
+};
 
-            for(int var33 = 0; var33 < var6; ++var33) {
-                double var34 = 0.0D;
-                double var36 = ((double)var33 - var31) * 12.0D / var27;
-                if(var36 < 0.0D) {
-                    var36 *= 4.0D;
-                }
+// Lowest and highest y the caves may change in each column of a chunk (x << 4 | z), low above high where no tunnel
+// step reaches. Traced from the cave rng alone: every step that would carve counts with its whole clamped box,
+// whatever the blocks in it, so the real carving of the chunk never leaves these ranges.
+struct CaveFootprint {
+    uint8_t low[256];
+    uint8_t high[256];
+};
 
-                double var38 = minLimitPerlinNoise[var14] / 512.0D;
-                double var40 = maxLimitPerlinNoise[var14] / 512.0D;
-                double var42 = (mainLimitPerlinNoise[var14] / 10.0D + 1.0D) / 2.0D;
-                if(var42 < 0.0D) {
-                    var34 = var38;
-                } else if(var42 > 1.0D) {
-                    var34 = var40;
-                } else {
-                    var34 = var38 + (var40 - var38) * var42;
-                }
+// Fills one 4x8x4 interpolation cell with the 8 y layers of a column as vector lanes, so every (x, z) of the cell
+// is a single contiguous 8 byte store (y is the stride 1 axis of the chunk). Each lane replays the exact sequence
+// of adds of the scalar loop for its layer, so the densities and the blocks are bit-identical to it.
+static inline void fillTerrainCell(uint8_t *chunkCache, const double *NoiseColumn, int var11, int var12, int var13, uint8_t cellSign, ClimateSampler *climate) {
+    int var7 = 64;
+    int var9 = 17;
+    int var10 = 5;
 
-                var34 -= var36;
-                if(var33 > var6 - 4) {
-                    double var44 = (double)((float)(var33 - (var6 - 4)) / 3.0F);
-                    var34 = var34 * (1.0D - var44) + -10.0D * var44;
+    // what a layer holds when it isn't stone, sea level ice is decided per column below
+    uint8_t layers[8];
+    for(int var32 = 0; var32 < 8; ++var32) {
+        layers[var32] = var13 * 8 + var32 < var7 ? MOVING_WATER : AIR;
+    }
+    bool seaLevel = var13 * 8 + 7 == var7 - 1;
+
+    if(cellSign != CELL_MIXED) {
+        for(int var43 = 0; var43 < 4; ++var43) {
+            for(int var52 = 0; var52 < 4; ++var52) {
+                uint8_t *out = chunkCache + ((var11 * 4 + var43) << 11 | (var12 * 4 + var52) << 7 | var13 * 8);
+                if(cellSign == CELL_SOLID) {
+                    memset(out, STONE, 8);
+                    continue;
+                }
+                memcpy(out, layers, 8);
+                if(seaLevel && climateTemperature(climate, var11 * 4 + var43, var12 * 4 + var52) < 0.5D) {
+                    out[7] = ICE;
                 }
+            }
+        }
+        return;
+    }
 
-                (*NoiseColumn)[var14] = var34;
-                ++var14;
+    double var14 = 0.125D;
+    double var16 = NoiseColumn[((var11 + 0) * var10 + var12 + 0) * var9 + var13];
+    double var18 = NoiseColumn[((var11 + 0) * var10 + var12 + 1) * var9 + var13];
+    double var20 = NoiseColumn[((var11 + 1) * var10 + var12 + 0) * var9 + var13];
+    double var22 = NoiseColumn[((var11 + 1) * var10 + var12 + 1) * var9 + var13];
+    double var24 = (NoiseColumn[((var11 + 0) * var10 + var12 + 0) * var9 + var13 + 1] - var16) * var14;
+    double var26 = (NoiseColumn[((var11 + 0) * var10 + var12 + 1) * var9 + var13 + 1] - var18) * var14;
+    double var28 = (NoiseColumn[((var11 + 1) * var10 + var12 + 0) * var9 + var13 + 1] - var20) * var14;
+    double var30 = (NoiseColumn[((var11 + 1) * var10 + var12 + 1) * var9 + var13 + 1] - var22) * var14;
+
+#if __GNUC__
+    f64x8 y16, y18, y20, y22;
+    for(int var32 = 0; var32 < 8; ++var32) {
+        y16[var32] = var16;
+        y18[var32] = var18;
+        y20[var32] = var20;
+        y22[var32] = var22;
+        var16 += var24;
+        var18 += var26;
+        var20 += var28;
+        var22 += var30;
+    }
+
+    i8x8 water;
+    memcpy(&water, layers, 8);
+    i8x8 stone = {STONE, STONE, STONE, STONE, STONE, STONE, STONE, STONE};
+    f64x8 var35 = y16;
+    f64x8 var37 = y18;
+    f64x8 var39 = (y20 - y16) * 0.25D;
+    f64x8 var41 = (y22 - y18) * 0.25D;
+
+    for(int var43 = 0; var43 < 4; ++var43) {
+        f64x8 var48 = var35;
+        f64x8 var50 = (var37 - var35) * 0.25D;
+
+        for(int var52 = 0; var52 < 4; ++var52) {
+            i8x8 solid = __builtin_convertvector(var48 > 0.0D, i8x8);
+            i8x8 blocks = (stone & solid) | (water & ~solid);
+            uint8_t *out = chunkCache + ((var11 * 4 + var43) << 11 | (var12 * 4 + var52) << 7 | var13 * 8);
+            memcpy(out, &blocks, 8);
+            // temperature is only ever read for the exposed sea level layer
+            if(seaLevel && !solid[7] && climateTemperature(climate, var11 * 4 + var43, var12 * 4 + var52) < 0.5D) {
+                out[7] = ICE;
             }
+            var48 += var50;
         }
+
+        var35 += var39;
+        var37 += var41;
     }
+#else
+    for(int var32 = 0; var32 < 8; ++var32) {
+        double var33 = 0.25D;
+        double var35 = var16;
+        double var37 = var18;
+        double var39 = (var20 - var16) * var33;
+        double var41 = (var22 - var18) * var33;
+
+        for(int var43 = 0; var43 < 4; ++var43) {
+            double var46 = 0.25D;
+            double var48 = var35;
+            double var50 = (var37 - var35) * var46;
+
+            for(int var52 = 0; var52 < 4; ++var52) {
+                int var55 = layers[var32];
+                if(var48 > 0.0D) {
+                    var55 = STONE;
+                } else if(seaLevel && var32 == 7 && climateTemperature(climate, var11 * 4 + var43, var12 * 4 + var52) < 0.5D) {
+                    var55 = ICE;
+                }
+                chunkCache[(var11 * 4 + var43) << 11 | (var12 * 4 + var52) << 7 | (var13 * 8 + var32)] = (uint8_t)var55;
+                var48 += var50;
+            }
 
-    delete[] surfaceNoise;
-    delete[] depthNoise;
-    delete[] mainLimitPerlinNoise;
-    delete[] minLimitPerlinNoise;
-    delete[] maxLimitPerlinNoise;
+            var35 += var39;
+            var37 += var41;
+        }
+
+        var16 += var24;
+        var18 += var26;
+        var20 += var28;
+        var22 += var30;
+    }
+#endif
 }
 
-static inline void generateTerrain(int chunkX, int chunkZ, uint8_t **chunkCache, double *temperatures, double *humidity, TerrainNoises terrainNoises) {
+static inline void generateTerrain(int chunkX, int chunkZ, uint8_t **chunkCache, ClimateSampler *climate, const TerrainNoises &terrainNoises, bool pruneOctaves, WaterLevels *water) {
     auto *NoiseColumn = new double[425];
     memset(NoiseColumn, 0, sizeof(double) * 425);
-    fillNoiseColumn(&NoiseColumn, chunkX * 4, chunkZ * 4, temperatures, humidity, terrainNoises);
-    
+    uint8_t cellSigns[4 * 4 * 16];
+    memset(cellSigns, CELL_MIXED, sizeof(cellSigns));
+    fillNoiseColumn(&NoiseColumn, chunkX * 4, chunkZ * 4, climate, terrainNoises, pruneOctaves ? cellSigns : nullptr);
+
     int var6 = 4;
-    int var7 = 64;
-    int var8 = var6 + 1;
-    int var9 = 17;
-    int var10 = var6 + 1;
 
     for(int var11 = 0; var11 < var6; ++var11) {
         for(int var12 = 0; var12 < var6; ++var12) {
             for(int var13 = 0; var13 < 16; ++var13) {
-                double var14 = 0.125D;
-                double var16 = NoiseColumn[((var11 + 0) * var10 + var12 + 0) * var9 + var13];
-                double var18 = NoiseColumn[((var11 + 0) * var10 + var12 + 1) * var9 + var13];
-                double var20 = NoiseColumn[((var11 + 1) * var10 + var12 + 0) * var9 + var13];
-                double var22 = NoiseColumn[((var11 + 1) * var10 + var12 + 1) * var9 + var13];
-                double var24 = (NoiseColumn[((var11 + 0) * var10 + var12 + 0) * var9 + var13 + 1] - var16) * var14;
-                double var26 = (NoiseColumn[((var11 + 0) * var10 + var12 + 1) * var9 + var13 + 1] - var18) * var14;
-                double var28 = (NoiseColumn[((var11 + 1) * var10 + var12 + 0) * var9 + var13 + 1] - var20) * var14;
-                double var30 = (NoiseColumn[((var11 + 1) * var10 + var12 + 1) * var9 + var13 + 1] - var22) * var14;
-
-                for(int var32 = 0; var32 < 8; ++var32) {
-                    double var33 = 0.25D;
-                    double var35 = var16;
-                    double var37 = var18;
-                    double var39 = (var20 - var16) * var33;
-                    double var41 = (var22 - var18) * var33;
-
-                    for(int var43 = 0; var43 < 4; ++var43) {
-                        int var44 = var43 + var11 * 4 << 11 | 0 + var12 * 4 << 7 | var13 * 8 + var32;
-                        short var45 = 128;
-                        double var46 = 0.25D;
-                        double var48 = var35;
-                        double var50 = (var37 - var35) * var46;
-
-                        for(int var52 = 0; var52 < 4; ++var52) {
-                            double var53 = temperatures[(var11 * 4 + var43) * 16 + var12 * 4 + var52];
-                            int var55 = 0;
-                            if(var13 * 8 + var32 < var7) {
-                                if(var53 < 0.5D && var13 * 8 + var32 >= var7 - 1) {
-                                    var55 = ICE;
-                                } else {
-                                    var55 = MOVING_WATER;
-                                }
-                            }
-
-                            if(var48 > 0.0D) {
-                                var55 = STONE;
-                            }
-
-                            (*chunkCache)[var44] = (uint8_t)var55;
-                            var44 += var45;
-                            var48 += var50;
-                        }
-
-                        var35 += var39;
-                        var37 += var41;
-                    }
-
-                    var16 += var24;
-                    var18 += var26;
-                    var20 += var28;
-                    var22 += var30;
-                }
+                fillTerrainCell(*chunkCache, NoiseColumn, var11, var12, var13, cellSigns[(var11 * 4 + var12) * 16 + var13], climate);
             }
         }
     }
     delete[]NoiseColumn;
+
+    water->top = -1;
+    for(int column = 0; column < 256; ++column) {
+        const uint8_t *blocks = *chunkCache + column * 128;
+        const auto *lowest = (const uint8_t *)memchr(blocks, MOVING_WATER, 64);
+        if(lowest == nullptr) {
+            water->low[column] = 128;
+            water->high[column] = 0;
+            continue;
+        }
+        int high = 63;
+        while(blocks[high] != MOVING_WATER) {
+            --high;
+        }
+        water->low[column] = (uint8_t)(lowest - blocks);
+        water->high[column] = (uint8_t)high;
+        water->top = high > water->top ? high : water->top;
+    }
 }
 
-static inline TerrainNoises *initTerrain(uint64_t worldSeed) {
-    auto *terrainNoises = new TerrainNoises;
+static inline void initTerrain(TerrainNoises *terrainNoises, uint64_t worldSeed) {
     Random worldRandom = get_random(worldSeed);
     PermutationTable *octaves = terrainNoises->minLimit;
     initOctaves(octaves, &worldRandom, 16);
@@ -779,7 +1141,6 @@ static inline TerrainNoises *initTerrain(uint64_t worldSeed) {
     initOctaves(octaves, &worldRandom, 10);
     octaves = terrainNoises->depth;
     initOctaves(octaves, &worldRandom, 16);
-    return terrainNoises;
 }
 
 #define PI 3.14159265358
@@ -790,13 +1151,146 @@ static int floor_double(double var0) {
     return var0 < (double)var2 ? var2 - 1 : var2;
 }
 
-void releaseEntitySkin(int var1, int var2, uint8_t *var3, double var4, double var6, double var8, float var10, float var11, float var12, int var13, int var14, double var15, uint64_t *rng); 
+// MathHelper.sin/cos: a 65536 entry table over one turn, this is what the cave carver sees instead of libm
+static float SIN_TABLE[65536];
+
+static bool init_sin_table() {
+    for (int i = 0; i < 65536; i++) {
+        SIN_TABLE[i] = (float)sin((double)i * 3.141592653589793 * 2.0 / 65536.0);
+    }
+    return true;
+}
+
+static bool sin_table_ready = init_sin_table();
+
+static inline float mathhelper_sin(float var0) {
+    return SIN_TABLE[(int)(var0 * 10430.378F) & 0xFFFF];
+}
+
+static inline float mathhelper_cos(float var0) {
+    return SIN_TABLE[(int)(var0 * 10430.378F + 16384.0F) & 0xFFFF];
+}
+
+void releaseEntitySkin(int var1, int var2, uint8_t *var3, const WaterLevels *water, CaveFootprint *footprint, double var4, double var6, double var8, float var10, float var11, float var12, int var13, int var14, double var15, uint64_t *rng); 
+
+// Java's abort test before carving a tunnel step: water anywhere between var54 - 1 and var36 + 1 in the box's border
+// columns, or at one of those two heights inside. Only the columns whose water levels meet that are looked at.
+static inline bool tunnelMeetsWater(const uint8_t *var3, const WaterLevels *water, int var53, int var34, int var54, int var36, int var55, int var38) {
+    int low = var54 - 1;
+    int high = var36 + 1;
+    if(low > water->top) {
+        return false;
+    }
+    for(int var40 = var53; var40 < var34; ++var40) {
+        for(int var41 = var55; var41 < var38; ++var41) {
+            int column = var40 * 16 + var41;
+            if(water->low[column] > high || water->high[column] < low) {
+                continue;
+            }
+            const uint8_t *blocks = var3 + column * 128;
+            if(var40 == var53 || var40 == var34 - 1 || var41 == var55 || var41 == var38 - 1) {
+                int from = low > water->low[column] ? low : water->low[column];
+                int to = high < water->high[column] ? high : water->high[column];
+                if(memchr(blocks + from, MOVING_WATER, to - from + 1) != nullptr) {
+                    return true;
+                }
+            } else if(blocks[low] == MOVING_WATER || blocks[high] == MOVING_WATER) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// The part of one column between var54 and var36 - 1 inside the tunnel's ellipsoid. Like Java, the block written for
+// var48 is the one above it.
+static inline void carveColumnScalar(uint8_t *column, int var54, int var36, double var6, double var29, double var57, double var44) {
+    int var46 = var36;
+    bool var47 = false;
+    for(int var48 = var36 - 1; var48 >= var54; --var48) {
+        double var49 = ((double)var48 + 0.5D - var6) / var29;
+        if(var49 > -0.7D && var57 * var57 + var49 * var49 + var44 * var44 < 1.0D) {
+            uint8_t var51 = column[var46];
+            if(var51 == GRASS) {
+                var47 = true;
+            }
 
-void func_870_a(int var1, int var2, uint8_t *var3, double var4, double var6, double var8, uint64_t *rng) {
-    releaseEntitySkin(var1, var2, var3, var4, var6, var8, 1.0F + nextFloat(rng) * 6.0F, 0.0F, 0.0F, -1, -1, 0.5D, rng);
+            if(var51 == STONE || var51 == DIRT || var51 == GRASS) {
+                if(var48 < 10) {
+                    column[var46] = LAVA;
+                } else {
+                    column[var46] = AIR;
+                    if(var47 && column[var46 - 1] == DIRT) {
+                        column[var46 - 1] = GRASS;
+                    }
+                }
+            }
+        }
+
+        --var46;
+    }
+}
+
+static inline bool insideTunnel(int var48, double var6, double var29, double var57, double var44) {
+    double var49 = ((double)var48 + 0.5D - var6) / var29;
+    return var49 > -0.7D && var57 * var57 + var49 * var49 + var44 * var44 < 1.0D;
 }
 
-void releaseEntitySkin(int var1, int var2, uint8_t *var3, double var4, double var6, double var8, float var10, float var11, float var12, int var13, int var14, double var15, uint64_t *rng) {
+// Every rounding step of insideTunnel's distance is monotone in |var49| and var49 in turn in var48, so the heights it
+// accepts are one run. The run is found from the closed form with a block of slack and trimmed with the exact test,
+// then the blocks in it are carved with a compare and blend per eight heights, bit-identical to the scalar loop.
+static inline void carveColumn(uint8_t *column, int var54, int var36, double var6, double var29, double var57, double var44) {
+    double reach = 1.0D - var57 * var57 - var44 * var44;
+    reach = reach > 0.0D ? sqrt(reach) * var29 : 0.0D;
+    double low = var6 - 0.5D - fmin(reach, 0.7D * var29);
+    int from = (int)floor(low) > var54 ? (int)floor(low) : var54;
+    int to = (int)ceil(var6 - 0.5D + reach) < var36 - 1 ? (int)ceil(var6 - 0.5D + reach) : var36 - 1;
+    while(from <= to && !insideTunnel(from, var6, var29, var57, var44)) {
+        ++from;
+    }
+    while(to >= from && !insideTunnel(to, var6, var29, var57, var44)) {
+        --to;
+    }
+    if(from > to) {
+        return;
+    }
+    // grass turns the dirt under it into grass as the column is carved top down, only that needs the serial order
+    if(memchr(column + from + 1, GRASS, to - from + 1) != nullptr) {
+        carveColumnScalar(column, var54, var36, var6, var29, var57, var44);
+        return;
+    }
+#if __GNUC__
+    const i8x8 lanes = {0, 1, 2, 3, 4, 5, 6, 7};
+    const i8x8 stone = {STONE, STONE, STONE, STONE, STONE, STONE, STONE, STONE};
+    const i8x8 dirt = {DIRT, DIRT, DIRT, DIRT, DIRT, DIRT, DIRT, DIRT};
+    const i8x8 lava = {LAVA, LAVA, LAVA, LAVA, LAVA, LAVA, LAVA, LAVA};
+    const i8x8 air = {AIR, AIR, AIR, AIR, AIR, AIR, AIR, AIR};
+    // the block of var48 is the one above it, the last eight bytes read end at most at the column's top
+    for(int var48 = from; var48 <= to; var48 += 8) {
+        i8x8 height = lanes + (int8_t)var48;
+        i8x8 blocks;
+        memcpy(&blocks, column + var48 + 1, 8);
+        i8x8 carve = (height <= (int8_t)to) & ((blocks == stone) | (blocks == dirt));
+        i8x8 deep = height < 10;
+        i8x8 fill = (lava & deep) | (air & ~deep);
+        blocks = (fill & carve) | (blocks & ~carve);
+        memcpy(column + var48 + 1, &blocks, 8);
+    }
+#else
+    for(int var48 = from; var48 <= to; ++var48) {
+        uint8_t var51 = column[var48 + 1];
+        if(var51 == STONE || var51 == DIRT) {
+            column[var48 + 1] = var48 < 10 ? LAVA : AIR;
+        }
+    }
+#endif
+}
+
+void func_870_a(int var1, int var2, uint8_t *var3, const WaterLevels *water, CaveFootprint *footprint, double var4, double var6, double var8, uint64_t *rng) {
+    releaseEntitySkin(var1, var2, var3, water, footprint, var4, var6, var8, 1.0F + nextFloat(rng) * 6.0F, 0.0F, 0.0F, -1, -1, 0.5D, rng);
+}
+
+void releaseEntitySkin(int var1, int var2, uint8_t *var3, const WaterLevels *water, CaveFootprint *footprint, double var4, double var6, double var8, float var10, float var11, float var12, int var13, int var14, double var15, uint64_t *rng) {
     double var17 = (double)(var1 * 16 + 8);
     double var19 = (double)(var2 * 16 + 8);
     float var21 = 0.0F;
@@ -818,13 +1312,13 @@ void releaseEntitySkin(int var1, int var2, uint8_t *var3, double var4, double va
     int var25 = nextInt(&var23, var14 / 2) + var14 / 4;
 
     for(bool var26 = nextInt(&var23, 6) == 0; var13 < var14; ++var13) {
-        double var27 = 1.5D + (double)(sinf((float)var13 * (float)PI / (float)var14) * var10 * 1.0F);
+        double var27 = 1.5D + (double)(mathhelper_sin((float)var13 * (float)PI / (float)var14) * var10 * 1.0F);
         double var29 = var27 * var15;
-        float var31 = cosf(var12);
-        float var32 = sinf(var12);
-        var4 += (double)(cosf(var11) * var31);
+        float var31 = mathhelper_cos(var12);
+        float var32 = mathhelper_sin(var12);
+        var4 += (double)(mathhelper_cos(var11) * var31);
         var6 += (double)var32;
-        var8 += (double)(sinf(var11) * var31);
+        var8 += (double)(mathhelper_sin(var11) * var31);
         if(var26) {
             var12 *= 0.92F;
         } else {
@@ -838,8 +1332,8 @@ void releaseEntitySkin(int var1, int var2, uint8_t *var3, double var4, double va
         var22 += (nextFloat(&var23) - nextFloat(&var23)) * nextFloat(&var23) * 2.0F;
         var21 += (nextFloat(&var23) - nextFloat(&var23)) * nextFloat(&var23) * 4.0F;
         if(!var52 && var13 == var25 && var10 > 1.0F) {
-            releaseEntitySkin(var1, var2, var3, var4, var6, var8, nextFloat(&var23) * 0.5F + 0.5F, var11 - (float)PI * 0.5F, var12 / 3.0F, var13, var14, 1.0D, rng);
-            releaseEntitySkin(var1, var2, var3, var4, var6, var8, nextFloat(&var23) * 0.5F + 0.5F, var11 + (float)PI * 0.5F, var12 / 3.0F, var13, var14, 1.0D, rng);
+            releaseEntitySkin(var1, var2, var3, water, footprint, var4, var6, var8, nextFloat(&var23) * 0.5F + 0.5F, var11 - (float)PI * 0.5F, var12 / 3.0F, var13, var14, 1.0D, rng);
+            releaseEntitySkin(var1, var2, var3, water, footprint, var4, var6, var8, nextFloat(&var23) * 0.5F + 0.5F, var11 + (float)PI * 0.5F, var12 / 3.0F, var13, var14, 1.0D, rng);
             return;
         }
 
@@ -883,58 +1377,32 @@ void releaseEntitySkin(int var1, int var2, uint8_t *var3, double var4, double va
                     var38 = 16;
                 }
 
-                bool var56 = false;
-
-                int var40;
-                int var43;
-                for(var40 = var53; !var56 && var40 < var34; ++var40) {
-                    for(int var41 = var55; !var56 && var41 < var38; ++var41) {
-                        for(int var42 = var36 + 1; !var56 && var42 >= var54 - 1; --var42) {
-                            var43 = (var40 * 16 + var41) * 128 + var42;
-                            if(var42 >= 0 && var42 < 128) {
-                                if(var3[var43] == MOVING_WATER || var3[var43] == MOVING_WATER) {
-                                    var56 = true;
-                                }
-
-                                if(var42 != var54 - 1 && var40 != var53 && var40 != var34 - 1 && var41 != var55 && var41 != var38 - 1) {
-                                    var42 = var54;
-                                }
-                            }
+                if(footprint) {
+                    // traced instead of carved, a room that stops at its first carve is followed to its end since
+                    // water may have kept that carve from happening. Heights var54 to var36 take the carved blocks
+                    // and the grass turned under them
+                    for(int var40 = var53; var40 < var34; ++var40) {
+                        for(int var41 = var55; var54 < var36 && var41 < var38; ++var41) {
+                            int column = var40 * 16 + var41;
+                            footprint->low[column] = var54 < footprint->low[column] ? (uint8_t)var54 : footprint->low[column];
+                            footprint->high[column] = var36 > footprint->high[column] ? (uint8_t)var36 : footprint->high[column];
                         }
                     }
+                    continue;
                 }
 
+                bool var56 = tunnelMeetsWater(var3, water, var53, var34, var54, var36, var55, var38);
+
+                int var40;
+                int var43;
                 if(!var56) {
                     for(var40 = var53; var40 < var34; ++var40) {
                         double var57 = ((double)(var40 + var1 * 16) + 0.5D - var4) / var27;
 
                         for(var43 = var55; var43 < var38; ++var43) {
                             double var44 = ((double)(var43 + var2 * 16) + 0.5D - var8) / var27;
-                            int var46 = (var40 * 16 + var43) * 128 + var36;
-                            bool var47 = false;
                             if(var57 * var57 + var44 * var44 < 1.0D) {
-                                for(int var48 = var36 - 1; var48 >= var54; --var48) {
-                                    double var49 = ((double)var48 + 0.5D - var6) / var29;
-                                    if(var49 > -0.7D && var57 * var57 + var49 * var49 + var44 * var44 < 1.0D) {
-                                        uint8_t var51 = var3[var46];
-                                        if(var51 == GRASS) {
-                                            var47 = true;
-                                        }
-
-                                        if(var51 == STONE || var51 == DIRT || var51 == GRASS) {
-                                            if(var48 < 10) {
-                                                var3[var46] = LAVA;
-                                            } else {
-                                                var3[var46] = AIR;
-                                                if(var47 && var3[var46 - 1] == DIRT) {
-                                                    var3[var46 - 1] = GRASS;
-                                                }
-                                            }
-                                        }
-                                    }
-
-                                    --var46;
-                                }
+                                carveColumn(var3 + (var40 * 16 + var43) * 128, var54, var36, var6, var29, var57, var44);
                             }
                         }
                     }
@@ -949,12 +1417,28 @@ void releaseEntitySkin(int var1, int var2, uint8_t *var3, double var4, double va
 
 }
 
-static inline void caves(int var2, int var3, int var4, int var5, uint8_t *chunkCache, uint64_t *rng) {
+// how many tunnels a source chunk starts, the first draws of its cave rng
+static inline int caveTunnels(uint64_t *rng) {
     int var7 = nextInt(rng, nextInt(rng, nextInt(rng, 40) + 1) + 1);
 
     if (nextInt(rng, 15) != 0) {
         var7 = 0;
     }
+    return var7;
+}
+
+// the multipliers of the source chunk coordinates in the cave rng seeds of a world
+static inline void caveMultipliers(uint64_t worldSeed, uint64_t *var7, uint64_t *var9) {
+    uint64_t rng;
+    setSeed(&rng, worldSeed);
+    *var7 = ((int64_t)nextLong(&rng) / 2) * 2 + 1;
+    *var9 = ((int64_t)nextLong(&rng) / 2) * 2 + 1;
+}
+
+// the tunnels started in source chunk var2, var3 that reach chunk var4, var5: carved into chunkCache, or traced into
+// footprint when that is set
+static inline void caves(int var2, int var3, int var4, int var5, uint8_t *chunkCache, const WaterLevels *water, CaveFootprint *footprint, uint64_t *rng) {
+    int var7 = caveTunnels(rng);
 
     for(int var8 = 0; var8 < var7; ++var8) {
         int v = nextInt(rng, 16);
@@ -963,7 +1447,7 @@ static inline void caves(int var2, int var3, int var4, int var5, uint8_t *chunkC
         double var13 = (double)(var3 * 16 + nextInt(rng, 16));
         int var15 = 1;
         if(nextInt(rng, 4) == 0) {
-            func_870_a(var4, var5, chunkCache, var9, var11, var13, rng);
+            func_870_a(var4, var5, chunkCache, water, footprint, var9, var11, var13, rng);
             var15 += nextInt(rng, 4);
         }
 
@@ -971,44 +1455,536 @@ static inline void caves(int var2, int var3, int var4, int var5, uint8_t *chunkC
             float var17 = nextFloat(rng) * (float)PI * 2.0F;
             float var18 = (nextFloat(rng) - 0.5F) * 2.0F / 8.0F;
             float var19 = nextFloat(rng) * 2.0F + nextFloat(rng);
-            releaseEntitySkin(var4, var5, chunkCache, var9, var11, var13, var19, var17, var18, 0, 0, 1.0D, rng);
+            releaseEntitySkin(var4, var5, chunkCache, water, footprint, var9, var11, var13, var19, var17, var18, 0, 0, 1.0D, rng);
         }
     }
 }
 
-static inline void generateCaves(uint64_t worldSeed, int var3, int var4, uint8_t *chunkCache) {
+static inline void generateCaves(uint64_t worldSeed, int var3, int var4, uint8_t *chunkCache, const WaterLevels *water) {
     uint64_t rng;
     int var6 = 8;
-    setSeed(&rng, worldSeed);
-    uint64_t var7 = ((int64_t)nextLong(&rng) / 2) * 2 + 1;
-    uint64_t var9 = ((int64_t)nextLong(&rng) / 2) * 2 + 1;
+    uint64_t var7, var9;
+    caveMultipliers(worldSeed, &var7, &var9);
     for(int var11 = var3 - var6; var11 <= var3 + var6; ++var11) {
         for(int var12 = var4 - var6; var12 <= var4 + var6; ++var12) {
             setSeed(&rng, (uint64_t)var11 * var7 + (uint64_t)var12 * var9 ^ worldSeed);
-            caves(var11, var12, var3, var4, chunkCache, &rng);
+            caves(var11, var12, var3, var4, chunkCache, water, nullptr, &rng);
+        }
+    }
+}
+
+// Source chunks per side of a tile of the cave map, and how many chunk footprints a world keeps before starting over.
+#define CAVE_TILE 32
+#define CAVE_FOOTPRINTS_KEPT 4096
+
+// How many tunnels every source chunk of a tile starts, most start none.
+struct CaveTile {
+    uint8_t tunnels[CAVE_TILE * CAVE_TILE];
+};
+
+// A world's cave map, filled as the scans ask for it: tunnel counts of the source chunks by tile and the
+// footprints of the chunks traced from them.
+struct CaveMap {
+    uint64_t seed;
+    uint64_t var7, var9;
+    std::map<std::tuple<int, int>, CaveTile> tiles;
+    std::map<std::tuple<int, int>, CaveFootprint> footprints;
+};
+
+static inline int floorDivide(int value, int divisor) {
+    return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+static const CaveTile &caveTile(CaveMap *map, int tileX, int tileZ) {
+    std::tuple<int, int> key(tileX, tileZ);
+    auto it = map->tiles.find(key);
+    if (it != map->tiles.end()) {
+        return it->second;
+    }
+    CaveTile &tile = map->tiles[key];
+    for (int i = 0; i < CAVE_TILE; i++) {
+        for (int k = 0; k < CAVE_TILE; k++) {
+            uint64_t rng;
+            setSeed(&rng, ((uint64_t)(tileX * CAVE_TILE + i) * map->var7 + (uint64_t)(tileZ * CAVE_TILE + k) * map->var9) ^ map->seed);
+            tile.tunnels[i * CAVE_TILE + k] = (uint8_t)caveTunnels(&rng);
         }
     }
+    return tile;
 }
 
-Chunk TerrainWrapper(uint64_t worldSeed, int32_t chunkX, int32_t chunkZ);
+// built on first use and rebuilt when the world's seed changed under it
+static CaveMap *worldCaves(World *world) {
+    if (world->caves == nullptr || world->caves->seed != world->seed) {
+        delete world->caves;
+        world->caves = new CaveMap;
+        world->caves->seed = world->seed;
+        caveMultipliers(world->seed, &world->caves->var7, &world->caves->var9);
+    }
+    return world->caves;
+}
+
+// generateCaves without the blocks: only the source chunks that start tunnels are replayed, and traced
+static const CaveFootprint &caveFootprint(World *world, int chunkX, int chunkZ) {
+    CaveMap *map = worldCaves(world);
+    std::tuple<int, int> key(chunkX, chunkZ);
+    auto it = map->footprints.find(key);
+    if (it != map->footprints.end()) {
+        return it->second;
+    }
+    if (map->footprints.size() >= CAVE_FOOTPRINTS_KEPT) {
+        map->footprints.clear();
+    }
+    CaveFootprint &footprint = map->footprints[key];
+    memset(footprint.low, 128, sizeof(footprint.low));
+    memset(footprint.high, 0, sizeof(footprint.high));
+    const CaveTile *tile = nullptr;
+    int tileX = 0, tileZ = 0;
+    for (int sourceX = chunkX - 8; sourceX <= chunkX + 8; sourceX++) {
+        for (int sourceZ = chunkZ - 8; sourceZ <= chunkZ + 8; sourceZ++) {
+            int x = floorDivide(sourceX, CAVE_TILE), z = floorDivide(sourceZ, CAVE_TILE);
+            if (tile == nullptr || x != tileX || z != tileZ) {
+                tile = &caveTile(map, x, z);
+                tileX = x;
+                tileZ = z;
+            }
+            if (tile->tunnels[(sourceX - x * CAVE_TILE) * CAVE_TILE + (sourceZ - z * CAVE_TILE)] == 0) {
+                continue;
+            }
+            uint64_t rng;
+            setSeed(&rng, ((uint64_t)sourceX * map->var7 + (uint64_t)sourceZ * map->var9) ^ map->seed);
+            caves(sourceX, sourceZ, chunkX, chunkZ, nullptr, nullptr, &footprint, &rng);
+        }
+    }
+    return footprint;
+}
+
+// whether no cave can change a block of the box, then the blocks in it are the terrain's
+static bool caveFreeBox(World *world, int minX, int maxX, int minY, int maxY, int minZ, int maxZ) {
+    for (int cx = minX >> 4; cx <= maxX >> 4; cx++) {
+        for (int cz = minZ >> 4; cz <= maxZ >> 4; cz++) {
+            const CaveFootprint &footprint = caveFootprint(world, cx, cz);
+            int x0 = minX > cx * 16 ? minX - cx * 16 : 0, x1 = maxX < cx * 16 + 15 ? maxX - cx * 16 : 15;
+            int z0 = minZ > cz * 16 ? minZ - cz * 16 : 0, z1 = maxZ < cz * 16 + 15 ? maxZ - cz * 16 : 15;
+            for (int x = x0; x <= x1; x++) {
+                for (int z = z0; z <= z1; z++) {
+                    int column = x * 16 + z;
+                    if (footprint.low[column] <= maxY && footprint.high[column] >= minY) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static NoiseContext *worldNoises(World *world);
 
 uint8_t getBlockID(World *world, int x, int y, int z) {
+    // like World.getBlockId, outside the height range is air (and never indexes past the chunk buffer)
+    if (y < 0 || y >= 128) {
+        return AIR;
+    }
     std::tuple<int, int> key = std::tuple<int, int>(x >> 4, z >> 4);
-    if (world->chunks.count(key) < 1) {
-        Chunk c = TerrainWrapper(world->seed, x >> 4, z >> 4);
-        world->chunks[std::tuple<int, int>(x >> 4, z >> 4)] = c;
+    auto it = world->chunks.find(key);
+    if (it == world->chunks.end()) {
+        Chunk c;
+        ChunkStore *store = worldStore(world);
+        if (store) {
+            c = (Chunk){.cx=x >> 4, .cz=z >> 4, .blocks=acquireChunk(store, x >> 4, z >> 4), .store=store};
+        } else {
+            c = generateChunk(worldNoises(world), x >> 4, z >> 4, world->prune_octaves);
+        }
+        it = world->chunks.emplace(key, c).first;
     }
-    Chunk c = world->chunks.at(key); 
+    const Chunk &c = it->second;
     int cx = x & 15;
     int cy = y;
     int cz = z & 15;
     return c.blocks[cx << 11 | cz << 7 | cy];
 }
 
-static inline bool generate_dungeons(World *world, int var3, int var4, int var5, uint64_t *rng, int *x, int *z) {
+// Float pre-filter: before a candidate reads any block, its box is classified from float32 evaluations of the
+// terrain density at the grid samples around it, 16 samples to a vector (twice the f64x8 lanes). Every sample
+// carries a bound on its float error, so a block's density is known to lie in an interval and the block is only
+// called stone or empty when the whole interval agrees. Caves turn stone into air (lava below y 10) and never
+// touch anything else, which pins down a block's final state whenever its terrain is provably empty, or provably
+// stone below y 10. Only candidates proven to fail are dropped, everything else goes through generate_dungeons.
+
+// 16 min limit, 16 max limit and 8 main limit octaves, in that order
+#define PREFILTER_OCTAVES 40
+// The fractions and fades are the exact doubles rounded once. Following the float roundings through the grads
+// and the three nested lerps gives under 10 * 2^-22 for an octave at unit amplitude, this keeps a factor 4.
+#define PREFILTER_OCTAVE_ERROR 0x1.0p-16
+
+struct PrefilterOctave {
+    uint8_t yBottoms[17];
+    // the grads of a sample are taken at the fraction of the first Y of its yBottoms run, see generateNormalPermutations
+    float yGrad[17];
+    float fadeY[17];
+};
+
+struct NoiseContext {
+    uint64_t seed;
+    TerrainNoises terrain;
+    BiomeNoises biomes;
+    PrefilterOctave octaves[PREFILTER_OCTAVES];
+    // bounds on how far the float sums of the min, max and main limit noises are from the exact ones
+    double minError, maxError, mainError;
+};
+
+static inline const PermutationTable *prefilterTable(const NoiseContext *context, int octave) {
+    if (octave < 16) return &context->terrain.minLimit[octave];
+    if (octave < 32) return &context->terrain.maxLimit[octave - 16];
+    return &context->terrain.mainLimit[octave - 32];
+}
+
+// the noiseFactor fillNoiseColumn hands generateNormalPermutations for this octave, horizontally or vertically
+static inline double prefilterFactor(int octave, bool vertical) {
+    double d = 684.41200000000003;
+    double d1 = 684.41200000000003;
+    if (octave < 32) {
+        return (vertical ? d1 : d) * ldexp(1.0, -(octave & 15));
+    }
+    return (vertical ? d1 / 160 : d / 80) * ldexp(1.0, -(octave - 32));
+}
+
+static inline double prefilterFraction(double coord, uint8_t *bottoms, double *fade) {
+    auto clamped = (int32_t) coord;
+    if (coord < (double) clamped) {
+        clamped--;
+    }
+    *bottoms = (uint8_t) ((uint32_t) clamped & 0xffu);
+    coord -= clamped;
+    double t = coord * 6 - 15;
+    double w = coord * t + 10;
+    *fade = coord * coord * coord * w;
+    return coord;
+}
+
+// the float error of a sum of octaves 0..count-1: each octave's own error plus the rounding of every partial sum
+static inline double prefilterSumError(int count) {
+    double error = 0.0, bound = 0.0;
+    for (int octave = 0; octave < count; octave++) {
+        error += PREFILTER_OCTAVE_ERROR * ldexp(1.0, octave);
+        bound += OCTAVE_BOUND * ldexp(1.0, octave);
+        error += ldexp(bound, -24);
+    }
+    return error;
+}
+
+NoiseContext *createNoiseContext(uint64_t seed) {
+    auto *context = new NoiseContext;
+    context->seed = seed;
+    initTerrain(&context->terrain, seed);
+    initBiomeGen(&context->biomes, seed);
+    // y never depends on the column, so the gradient cache runs are the same for every sample of a seed
+    for (int octave = 0; octave < PREFILTER_OCTAVES; octave++) {
+        PrefilterOctave &table = context->octaves[octave];
+        double factor = prefilterFactor(octave, true);
+        double yo = prefilterTable(context, octave)->yo;
+        double runFraction = 0.0;
+        for (int Y = 0; Y < 17; Y++) {
+            double fade;
+            double fraction = prefilterFraction((0.0 + (double) Y) * factor + yo, &table.yBottoms[Y], &fade);
+            if (Y == 0 || table.yBottoms[Y] != table.yBottoms[Y - 1]) {
+                runFraction = fraction;
+            }
+            table.yGrad[Y] = (float) runFraction;
+            table.fadeY[Y] = (float) fade;
+        }
+    }
+    context->minError = prefilterSumError(16);
+    context->maxError = prefilterSumError(16);
+    context->mainError = prefilterSumError(8);
+    return context;
+}
+
+void destroyNoiseContext(NoiseContext *context) {
+    delete context;
+}
+
+// built on first use and rebuilt when the world's seed changed under it
+static NoiseContext *worldNoises(World *world) {
+    if (world->noises == nullptr || world->noises->seed != world->seed) {
+        destroyNoiseContext(world->noises);
+        world->noises = createNoiseContext(world->seed);
+    }
+    return world->noises;
+}
+
+#if __GNUC__
+// the float sample densities of one chunk's 5x17x5 grid as intervals, columns and samples are filled in as
+// candidates need them
+struct PrefilterGrid {
+    int chunkX, chunkZ;
+    bool ready;
+    ClimateSampler climate;
+    uint8_t xReady[5], zReady[5], columnReady[25];
+    double var27s[25], var31s[25];
+    uint8_t xBottoms[PREFILTER_OCTAVES][5], zBottoms[PREFILTER_OCTAVES][5];
+    float xFraction[PREFILTER_OCTAVES][5], zFraction[PREFILTER_OCTAVES][5];
+    float fadeX[PREFILTER_OCTAVES][5], fadeZ[PREFILTER_OCTAVES][5];
+    uint8_t known[425];
+    double lo[425], hi[425];
+};
+
+enum PrefilterTerrain {
+    TERRAIN_UNSURE,
+    TERRAIN_STONE,
+    TERRAIN_EMPTY // water, ice or air depending on the layer
+};
+
+enum PrefilterVerdict {
+    PREFILTER_FAIL,  // provably not a dungeon
+    PREFILTER_SOLID, // the box sits in stone above the lava, only caves could open it up
+    PREFILTER_OPEN   // anything else, generate_dungeons decides
+};
+
+// grad() as selects on the bits of the lanes. Vectors are handed back through a pointer, returning a 64 byte
+// vector would depend on AVX-512 being enabled
+static inline void gradLanes(f32x16 *out, const i32x16 &hash, const f32x16 &x, const f32x16 &y, const f32x16 &z) {
+    i32x16 h = hash & 15;
+    i32x16 uIsX = h < 8;
+    i32x16 vIsY = h < 4;
+    i32x16 vIsX = (h == 12) | (h == 14);
+    i32x16 xBits = (i32x16) x, yBits = (i32x16) y, zBits = (i32x16) z;
+    i32x16 u = (xBits & uIsX) | (yBits & ~uIsX);
+    i32x16 v = (yBits & vIsY) | (~vIsY & ((xBits & vIsX) | (zBits & ~vIsX)));
+    // negating is flipping the sign bit
+    u ^= (h & 1) << 31;
+    v ^= (h & 2) << 30;
+    *out = (f32x16) u + (f32x16) v;
+}
+
+static void preparePrefilterGrid(PrefilterGrid *grid, NoiseContext *context, int chunkX, int chunkZ) {
+    grid->chunkX = chunkX;
+    grid->chunkZ = chunkZ;
+    grid->ready = true;
+    initClimateSampler(&grid->climate, &context->biomes, chunkX * 16, chunkZ * 16);
+    memset(grid->xReady, 0, sizeof(grid->xReady));
+    memset(grid->zReady, 0, sizeof(grid->zReady));
+    memset(grid->columnReady, 0, sizeof(grid->columnReady));
+    memset(grid->known, 0, sizeof(grid->known));
+}
+
+// what fillNoiseColumn computes for column i, k, one column at a time
+static void preparePrefilterColumn(PrefilterGrid *grid, NoiseContext *context, int i, int k) {
+    if (!grid->xReady[i]) {
+        grid->xReady[i] = 1;
+        for (int octave = 0; octave < PREFILTER_OCTAVES; octave++) {
+            double fade;
+            double xCoord = ((double) (grid->chunkX * 4) + (double) i) * prefilterFactor(octave, false) + prefilterTable(context, octave)->xo;
+            grid->xFraction[octave][i] = (float) prefilterFraction(xCoord, &grid->xBottoms[octave][i], &fade);
+            grid->fadeX[octave][i] = (float) fade;
+        }
+    }
+    if (!grid->zReady[k]) {
+        grid->zReady[k] = 1;
+        for (int octave = 0; octave < PREFILTER_OCTAVES; octave++) {
+            double fade;
+            double zCoord = ((double) (grid->chunkZ * 4) + (double) k) * prefilterFactor(octave, false) + prefilterTable(context, octave)->zo;
+            grid->zFraction[octave][k] = (float) prefilterFraction(zCoord, &grid->zBottoms[octave][k], &fade);
+            grid->fadeZ[octave][k] = (float) fade;
+        }
+    }
+    int column = i * 5 + k;
+    if (!grid->columnReady[column]) {
+        grid->columnReady[column] = 1;
+        double surfaceNoise, depthNoise;
+        generateFixedNoise(&surfaceNoise, grid->chunkX * 4 + i, grid->chunkZ * 4 + k, 1, 1, 1.121, 1.121, context->terrain.scale, 10);
+        generateFixedNoise(&depthNoise, grid->chunkX * 4 + i, grid->chunkZ * 4 + k, 1, 1, 200.0, 200.0, context->terrain.depth, 16);
+        int var16 = 16 / 5;
+        double humidity = climateHumidity(&grid->climate, i * var16 + var16 / 2, k * var16 + var16 / 2);
+        double temperature = climateTemperature(&grid->climate, i * var16 + var16 / 2, k * var16 + var16 / 2);
+        columnShape(surfaceNoise, depthNoise, humidity, temperature, &grid->var27s[column], &grid->var31s[column]);
+    }
+}
+
+// evaluates the listed samples (column * 17 + Y) of the grid in lanes of 16
+static void computePrefilterSamples(PrefilterGrid *grid, const NoiseContext *context, const uint16_t *samples, int count) {
+    for (int first = 0; first < count; first += 16) {
+        int lanes = count - first < 16 ? count - first : 16;
+        f32x16 sums[3] = {};
+        for (int octave = 0; octave < PREFILTER_OCTAVES; octave++) {
+            const uint8_t *permutations = prefilterTable(context, octave)->permutations;
+            const PrefilterOctave &table = context->octaves[octave];
+            // gathered into plain arrays and loaded whole, inserting single lanes into a vector is slow without AVX-512
+            alignas(64) int32_t hashLanes[8][16];
+            alignas(64) float floatLanes[6][16];
+            for (int lane = 0; lane < 16; lane++) {
+                // unused lanes repeat the last sample
+                int sample = samples[first + (lane < lanes ? lane : lanes - 1)];
+                int column = sample / 17, Y = sample % 17;
+                int i = column / 5, k = column % 5;
+                uint8_t xBottoms = grid->xBottoms[octave][i];
+                uint8_t zBottoms = grid->zBottoms[octave][k];
+                uint8_t i2 = table.yBottoms[Y];
+                uint16_t k2 = permutations[permutations[xBottoms] + i2] + zBottoms;
+                uint16_t l2 = permutations[permutations[xBottoms] + i2 + 1] + zBottoms;
+                uint16_t k3 = permutations[permutations[xBottoms + 1] + i2] + zBottoms;
+                uint16_t l3 = permutations[permutations[xBottoms + 1] + i2 + 1] + zBottoms;
+                hashLanes[0][lane] = permutations[k2];
+                hashLanes[1][lane] = permutations[k3];
+                hashLanes[2][lane] = permutations[l2];
+                hashLanes[3][lane] = permutations[l3];
+                hashLanes[4][lane] = permutations[k2 + 1];
+                hashLanes[5][lane] = permutations[k3 + 1];
+                hashLanes[6][lane] = permutations[l2 + 1];
+                hashLanes[7][lane] = permutations[l3 + 1];
+                floatLanes[0][lane] = grid->xFraction[octave][i];
+                floatLanes[1][lane] = table.yGrad[Y];
+                floatLanes[2][lane] = grid->zFraction[octave][k];
+                floatLanes[3][lane] = grid->fadeX[octave][i];
+                floatLanes[4][lane] = table.fadeY[Y];
+                floatLanes[5][lane] = grid->fadeZ[octave][k];
+            }
+            i32x16 hashes[8];
+            memcpy(hashes, hashLanes, sizeof(hashes));
+            f32x16 x, y, z, fadeX, fadeY, fadeZ;
+            memcpy(&x, floatLanes[0], sizeof(x));
+            memcpy(&y, floatLanes[1], sizeof(y));
+            memcpy(&z, floatLanes[2], sizeof(z));
+            memcpy(&fadeX, floatLanes[3], sizeof(fadeX));
+            memcpy(&fadeY, floatLanes[4], sizeof(fadeY));
+            memcpy(&fadeZ, floatLanes[5], sizeof(fadeZ));
+            f32x16 x0 = x - 1.0f, y0 = y - 1.0f, z0 = z - 1.0f;
+            f32x16 grads[8];
+            gradLanes(&grads[0], hashes[0], x, y, z);
+            gradLanes(&grads[1], hashes[1], x0, y, z);
+            gradLanes(&grads[2], hashes[2], x, y0, z);
+            gradLanes(&grads[3], hashes[3], x0, y0, z);
+            gradLanes(&grads[4], hashes[4], x, y, z0);
+            gradLanes(&grads[5], hashes[5], x0, y, z0);
+            gradLanes(&grads[6], hashes[6], x, y0, z0);
+            gradLanes(&grads[7], hashes[7], x0, y0, z0);
+            f32x16 x1 = grads[0] + fadeX * (grads[1] - grads[0]);
+            f32x16 x2 = grads[2] + fadeX * (grads[3] - grads[2]);
+            f32x16 xx1 = grads[4] + fadeX * (grads[5] - grads[4]);
+            f32x16 xx2 = grads[6] + fadeX * (grads[7] - grads[6]);
+            f32x16 y1 = x1 + fadeY * (x2 - x1);
+            f32x16 y2 = xx1 + fadeY * (xx2 - xx1);
+            f32x16 value = y1 + fadeZ * (y2 - y1);
+            sums[octave < 16 ? 0 : octave < 32 ? 1 : 2] += value * (float) ldexp(1.0, octave < 32 ? octave & 15 : octave - 32);
+        }
+        for (int lane = 0; lane < lanes; lane++) {
+            int sample = samples[first + lane];
+            int column = sample / 17, Y = sample % 17;
+            // columnDensity is monotonic in each noise, so its extremes over the error box are at the corners
+            double lo = INFINITY, hi = -INFINITY;
+            for (int corner = 0; corner < 8; corner++) {
+                double density = columnDensity(Y, grid->var27s[column], grid->var31s[column],
+                                               (double) sums[0][lane] + ((corner & 1) ? context->minError : -context->minError),
+                                               (double) sums[1][lane] + ((corner & 2) ? context->maxError : -context->maxError),
+                                               (double) sums[2][lane] + ((corner & 4) ? context->mainError : -context->mainError));
+                lo = density < lo ? density : lo;
+                hi = density > hi ? density : hi;
+            }
+            grid->lo[sample] = lo;
+            grid->hi[sample] = hi;
+        }
+    }
+}
+
+// makes sure every grid sample around the blocks [x0, x1] x [y0, y1] x [z0, z1] of the grid's chunk is known
+static void requirePrefilterSamples(PrefilterGrid *grid, NoiseContext *context, int x0, int x1, int y0, int y1, int z0, int z1) {
+    uint16_t samples[425];
+    int count = 0;
+    for (int i = x0 >> 2; i <= (x1 >> 2) + 1; i++) {
+        for (int k = z0 >> 2; k <= (z1 >> 2) + 1; k++) {
+            preparePrefilterColumn(grid, context, i, k);
+            for (int j = y0 >> 3; j <= (y1 >> 3) + 1; j++) {
+                int sample = (i * 5 + k) * 17 + j;
+                if (!grid->known[sample]) {
+                    grid->known[sample] = 1;
+                    samples[count++] = (uint16_t) sample;
+                }
+            }
+        }
+    }
+    if (count > 0) {
+        computePrefilterSamples(grid, context, samples, count);
+    }
+}
+
+// the terrain block before caves, from the trilinear interpolation fillTerrainCell does of the sample intervals
+static inline int prefilterTerrain(const PrefilterGrid *grid, int x, int y, int z) {
+    int i = x >> 2, k = z >> 2, j = y >> 3;
+    double fx = (x & 3) * 0.25, fz = (z & 3) * 0.25, fy = (y & 7) * 0.125;
+    double lo = 0.0, hi = 0.0;
+    for (int corner = 0; corner < 8; corner++) {
+        int dx = corner & 1, dz = (corner >> 1) & 1, dy = corner >> 2;
+        double weight = (dx ? fx : 1.0 - fx) * (dz ? fz : 1.0 - fz) * (dy ? fy : 1.0 - fy);
+        int sample = ((i + dx) * 5 + k + dz) * 17 + j + dy;
+        lo += weight * grid->lo[sample];
+        hi += weight * grid->hi[sample];
+    }
+    if (lo > DENSITY_SIGN_MARGIN) return TERRAIN_STONE;
+    if (hi < -DENSITY_SIGN_MARGIN) return TERRAIN_EMPTY;
+    return TERRAIN_UNSURE;
+}
+
+// grids holds the chunks (chunkX, chunkZ) to (chunkX + 1, chunkZ + 1), the most a candidate of chunkX, chunkZ reaches
+// caveFree: no cave reaches the box (see caveFreeBox), so stone stays stone
+static int prefilterCandidate(PrefilterGrid grids[4], NoiseContext *context, int chunkX, int chunkZ, const DungeonCandidate &candidate, bool caveFree) {
+    int minX = candidate.x - candidate.sizeX - 1, maxX = candidate.x + candidate.sizeX + 1;
+    int minZ = candidate.z - candidate.sizeZ - 1, maxZ = candidate.z + candidate.sizeZ + 1;
+    int minY = candidate.y - 1, maxY = candidate.y + 4;
+    auto require = [&](int fromX, int toX, int fromZ, int toZ) {
+        for (int cx = fromX >> 4; cx <= toX >> 4; cx++) {
+            for (int cz = fromZ >> 4; cz <= toZ >> 4; cz++) {
+                PrefilterGrid *grid = &grids[(cx - chunkX) * 2 + (cz - chunkZ)];
+                if (!grid->ready) {
+                    preparePrefilterGrid(grid, context, cx, cz);
+                }
+                int x0 = fromX > cx * 16 ? fromX - cx * 16 : 0, x1 = toX < cx * 16 + 15 ? toX - cx * 16 : 15;
+                int z0 = fromZ > cz * 16 ? fromZ - cz * 16 : 0, z1 = toZ < cz * 16 + 15 ? toZ - cz * 16 : 15;
+                requirePrefilterSamples(grid, context, x0, x1, minY, maxY, z0, z1);
+            }
+        }
+    };
+    auto terrain = [&](int x, int y, int z) {
+        const PrefilterGrid *grid = &grids[((x >> 4) - chunkX) * 2 + ((z >> 4) - chunkZ)];
+        return prefilterTerrain(grid, x & 15, y, z & 15);
+    };
+    // what the block is once the caves are in: 1 surely air, -1 surely not, 0 open
+    auto air = [&](int x, int y, int z) {
+        int block = terrain(x, y, z);
+        if (block == TERRAIN_EMPTY) return y >= 64 ? 1 : -1;
+        if (block == TERRAIN_STONE && (y < 10 || caveFree)) return -1;
+        return 0;
+    };
+
+    // The centre column settles most candidates from a single cell: a room in the air fails on it, a room buried in
+    // stone above the lava can't be ruled out by the terrain at all and isn't worth the rest of the box.
+    require(candidate.x, candidate.x, candidate.z, candidate.z);
+    if (air(candidate.x, minY, candidate.z) == 1 || air(candidate.x, maxY, candidate.z) == 1) {
+        return PREFILTER_FAIL;
+    }
+    if (!caveFree && candidate.y >= 10 && terrain(candidate.x, minY, candidate.z) == TERRAIN_STONE && terrain(candidate.x, maxY, candidate.z) == TERRAIN_STONE) {
+        return PREFILTER_SOLID;
+    }
+    require(minX, maxX, minZ, maxZ);
+
+    int openings = 0, possibleOpenings = 0;
+    for (int x = minX; x <= maxX; x++) {
+        for (int z = minZ; z <= maxZ; z++) {
+            if (air(x, minY, z) == 1 || air(x, maxY, z) == 1) {
+                return PREFILTER_FAIL;
+            }
+            if (x == minX || x == maxX || z == minZ || z == maxZ) {
+                int lower = air(x, candidate.y, z), upper = air(x, candidate.y + 1, z);
+                openings += lower == 1 && upper == 1;
+                possibleOpenings += lower != -1 && upper != -1;
+            }
+        }
+    }
+    return openings > 5 || possibleOpenings == 0 ? PREFILTER_FAIL : PREFILTER_OPEN;
+}
+#endif
+
+static inline bool generate_dungeons(World *world, int var3, int var4, int var5, int var7, int var8, int *x, int *z) {
     uint8_t var6 = 3;
-    int var7 = nextInt(rng, 2) + 2;
-    int var8 = nextInt(rng, 2) + 2;
     int var9 = 0;
 
     int var10;
@@ -1040,46 +2016,126 @@ static inline bool generate_dungeons(World *world, int var3, int var4, int var5,
     return false;
 }
 
-static inline uint8_t *provideChunk(uint64_t worldSeed, int chunkX, int chunkZ, BiomeResult *biomeResult, TerrainNoises *terrainNoises) {
+static inline uint8_t *provideChunk(uint64_t worldSeed, int chunkX, int chunkZ, ClimateSampler *climate, const TerrainNoises &terrainNoises, bool pruneOctaves) {
     Random worldRandom = get_random((uint64_t) ((long) chunkX * 0x4f9939f508L + (long) chunkZ * 0x1ef1565bd5L));
     auto *chunkCache = new uint8_t[16 * 16 * 128];
-    generateTerrain(chunkX, chunkZ, &chunkCache, biomeResult->temperature, biomeResult->humidity, *terrainNoises);
-    generateCaves(worldSeed, chunkX, chunkZ, chunkCache);
+    WaterLevels water;
+    generateTerrain(chunkX, chunkZ, &chunkCache, climate, terrainNoises, pruneOctaves, &water);
+    generateCaves(worldSeed, chunkX, chunkZ, chunkCache, &water);
 
     return chunkCache;    
 }
 
-DungeonResult chunkHasDungeon(World *world, int chunkX, int chunkZ) {
-    DungeonResult result;
-    result.has_dungeon = false;
-
+int dungeonCandidates(uint64_t worldSeed, int chunkX, int chunkZ, DungeonCandidate candidates[8]) {
     int var4 = chunkX * 16;
 	int var5 = chunkZ * 16;
 
     uint64_t rng;
-    setSeed(&rng, world->seed);
+    setSeed(&rng, worldSeed);
     uint64_t var7 = ((int64_t)nextLong(&rng) / 2L) * 2L + 1L;
     uint64_t var9 = ((int64_t)nextLong(&rng) / 2L) * 2L + 1L;
-    setSeed(&rng, (long)chunkX * var7 + (long)chunkZ * var9 ^ world->seed);
+    setSeed(&rng, (long)chunkX * var7 + (long)chunkZ * var9 ^ worldSeed);
 
-    double var11 = 0.25D;
     int var13;
-    int var14;
-    int var15;
     if(nextInt(&rng, 4) == 0) {
-        return result;
+        return 0;
     }
 
     if(nextInt(&rng, 8) == 0) {
-        return result;
+        return 0;
     }
-    int var16;
+    // the terrain checks never touch the rng, so all eight attempts are known up front
     for(var13 = 0; var13 < 8; ++var13) {
-        var14 = var4 + nextInt(&rng, 16) + 8;
-        var15 = nextInt(&rng, 128);
-        var16 = var5 + nextInt(&rng, 16) + 8;
+        DungeonCandidate &candidate = candidates[var13];
+        candidate.x = var4 + nextInt(&rng, 16) + 8;
+        candidate.y = nextInt(&rng, 128);
+        candidate.z = var5 + nextInt(&rng, 16) + 8;
+        candidate.sizeX = nextInt(&rng, 2) + 2;
+        candidate.sizeZ = nextInt(&rng, 2) + 2;
+    }
+    return 8;
+}
+
+static inline bool candidateChunksLoaded(World *world, const DungeonCandidate &candidate) {
+    for (int cx = dungeonCandidateCornerX(candidate) >> 4; cx <= (candidate.x + candidate.sizeX + 1) >> 4; cx++) {
+        for (int cz = (candidate.z - candidate.sizeZ - 1) >> 4; cz <= (candidate.z + candidate.sizeZ + 1) >> 4; cz++) {
+            if (world->chunks.find(std::tuple<int, int>(cx, cz)) == world->chunks.end()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+#if __GNUC__
+// past this the int32 floors overflow, like for the exact-sign mode
+static inline bool prefilterInRange(World *world, int chunkX, int chunkZ) {
+    return world->prefilter && exactSignInRange(chunkX * 4, chunkZ * 4) && exactSignInRange(chunkX * 4 + 4, chunkZ * 4 + 4);
+}
+
+// A box in solid stone only fails on the terrain when the cave rng shows no tunnel reaching it, else whether a cave
+// opens it up is only known from the generated chunks
+static bool prefilterRejects(World *world, PrefilterGrid grids[4], int chunkX, int chunkZ, const DungeonCandidate &candidate) {
+    int verdict = prefilterCandidate(grids, worldNoises(world), chunkX, chunkZ, candidate, false);
+    if (verdict == PREFILTER_SOLID && caveFreeBox(world, candidate.x - candidate.sizeX - 1, candidate.x + candidate.sizeX + 1, candidate.y - 1, candidate.y + 4, candidate.z - candidate.sizeZ - 1, candidate.z + candidate.sizeZ + 1)) {
+        verdict = prefilterCandidate(grids, worldNoises(world), chunkX, chunkZ, candidate, true);
+    }
+    return verdict == PREFILTER_FAIL;
+}
+#endif
+
+uint8_t screenDungeonCandidates(World *world, int chunkX, int chunkZ, const DungeonCandidate candidates[8], int count) {
+    uint8_t rejected = 0;
+#if __GNUC__
+    bool prefilter = prefilterInRange(world, chunkX, chunkZ);
+    PrefilterGrid grids[4];
+    for (PrefilterGrid &grid : grids) {
+        grid.ready = false;
+    }
+#endif
+    for (int i = 0; i < count; i++) {
+        if (!dungeonCandidateInHeight(candidates[i])) {
+            rejected |= 1 << i;
+        }
+#if __GNUC__
+        else if (prefilter && prefilterRejects(world, grids, chunkX, chunkZ, candidates[i])) {
+            rejected |= 1 << i;
+        }
+#endif
+    }
+    return rejected;
+}
+
+// rejected: the candidates screenDungeonCandidates ruled out, the others were screened too and go straight to
+// generate_dungeons. Without it the pre-filter runs here. tested counts the candidates looked at
+static DungeonResult populateDungeons(World *world, int chunkX, int chunkZ, const uint8_t *rejected, int *tested) {
+    DungeonResult result;
+    result.has_dungeon = false;
+
+    DungeonCandidate candidates[8];
+    int count = dungeonCandidates(world->seed, chunkX, chunkZ, candidates);
+#if __GNUC__
+    bool prefilter = prefilterInRange(world, chunkX, chunkZ);
+    PrefilterGrid grids[4];
+    for (PrefilterGrid &grid : grids) {
+        grid.ready = false;
+    }
+#endif
+    for (int i = 0; i < count; i++) {
+        const DungeonCandidate &candidate = candidates[i];
+        // the floor or the ceiling would be out of the world, which reads as air
+        if (!dungeonCandidateInHeight(candidate) || (rejected && (*rejected & 1 << i))) {
+            continue;
+        }
+        (*tested)++;
+#if __GNUC__
+        // once its chunks are loaded generate_dungeons is cheaper than the pre-filter
+        if (prefilter && !rejected && !candidateChunksLoaded(world, candidate) && prefilterRejects(world, grids, chunkX, chunkZ, candidate)) {
+            continue;
+        }
+#endif
         int x, z;
-        if (generate_dungeons(world, var14, var15, var16, &rng, &x, &z)) {
+        if (generate_dungeons(world, candidate.x, candidate.y, candidate.z, candidate.sizeX, candidate.sizeZ, &x, &z)) {
             result.has_dungeon = true;
             result.x = x;
             result.z = z;
@@ -1089,34 +2145,150 @@ DungeonResult chunkHasDungeon(World *world, int chunkX, int chunkZ) {
     return result;
 }
 
+static DungeonResult checkChunk(World *world, int chunkX, int chunkZ, const uint8_t *rejected) {
+    DungeonResult result;
+    if (world->index && indexLookupChunk(world->index, chunkX, chunkZ, &result)) {
+        if (world->progress) {
+            countScanProgress(world->progress, 1, 0, result.has_dungeon);
+        }
+        return result;
+    }
+    int tested = 0;
+    result = populateDungeons(world, chunkX, chunkZ, rejected, &tested);
+    if (world->progress) {
+        countScanProgress(world->progress, 1, tested, result.has_dungeon);
+    }
+    if (worldStore(world)) {
+        // let go of the store's chunks so they can be evicted, the store is the cache in that mode
+        free_world(*world);
+    }
+    if (world->index) {
+        indexRecordChunk(world->index, chunkX, chunkZ, result);
+    }
+    return result;
+}
+
+DungeonResult chunkHasDungeon(World *world, int chunkX, int chunkZ) {
+    return checkChunk(world, chunkX, chunkZ, nullptr);
+}
+
+DungeonResult chunkHasDungeonScreened(World *world, int chunkX, int chunkZ, uint8_t rejected) {
+    return checkChunk(world, chunkX, chunkZ, &rejected);
+}
+
+void scanRegion(World *world, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, std::vector<DungeonResult> *results) {
+    // walked so neighbouring boxes find their chunks still cached, reported in region order
+    ChunkWalk walk = scanWalk(minChunkX, minChunkZ, maxChunkX, maxChunkZ, worldStore(world) ? chunkStoreCapacity(world->store) : SCAN_CACHE_CHUNKS);
+    std::vector<std::pair<int64_t, DungeonResult>> found;
+    int cx, cz;
+    while (!scanCancelled(world->progress) && nextChunk(&walk, &cx, &cz)) {
+        DungeonResult result = chunkHasDungeon(world, cx, cz);
+        if (result.has_dungeon) {
+            found.emplace_back(((int64_t)cx - minChunkX) * (maxChunkZ - minChunkZ) + (cz - minChunkZ), result);
+        }
+    }
+    std::sort(found.begin(), found.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    for (const auto &[order, result] : found) {
+        results->push_back(result);
+    }
+}
+
 void delete_terrain_result(TerrainResult *terrainResult) {
     delete[] terrainResult->chunkHeights;
     delete_biome_result(terrainResult->biomeResult);
     delete terrainResult;
 }
 
-uint8_t *TerrainInternalWrapper(uint64_t worldSeed, int32_t chunkX, int32_t chunkZ, BiomeResult *biomeResult) {
-    TerrainNoises *terrainNoises = initTerrain(worldSeed);
-    uint8_t *chunkCache = provideChunk(worldSeed, chunkX, chunkZ, biomeResult, terrainNoises);
+uint8_t *TerrainInternalWrapper(uint64_t worldSeed, int32_t chunkX, int32_t chunkZ, ClimateSampler *climate, bool pruneOctaves) {
+    auto *terrainNoises = new TerrainNoises;
+    initTerrain(terrainNoises, worldSeed);
+    uint8_t *chunkCache = provideChunk(worldSeed, chunkX, chunkZ, climate, *terrainNoises, pruneOctaves);
     delete terrainNoises;
     return chunkCache;
 }
 
-Chunk TerrainWrapper(uint64_t worldSeed, int32_t chunkX, int32_t chunkZ) {
-    BiomeResult *biomeResult = BiomeWrapper(worldSeed, chunkX, chunkZ);
-    auto *chunkCache = TerrainInternalWrapper(worldSeed, chunkX, chunkZ, biomeResult);
-    delete_biome_result(biomeResult);
-    return (Chunk){.cx=chunkX, .cz=chunkZ, .blocks=chunkCache};
+Chunk generateChunk(const NoiseContext *context, int32_t chunkX, int32_t chunkZ, bool pruneOctaves) {
+    ClimateSampler climate;
+    initClimateSampler(&climate, &context->biomes, chunkX * 16, chunkZ * 16);
+    auto *chunkCache = provideChunk(context->seed, chunkX, chunkZ, &climate, context->terrain, pruneOctaves);
+    return (Chunk){.cx=chunkX, .cz=chunkZ, .blocks=chunkCache, .store=nullptr};
+}
+
+Chunk TerrainWrapper(uint64_t worldSeed, int32_t chunkX, int32_t chunkZ, bool pruneOctaves) {
+    NoiseContext *context = createNoiseContext(worldSeed);
+    Chunk chunk = generateChunk(context, chunkX, chunkZ, pruneOctaves);
+    destroyNoiseContext(context);
+    return chunk;
+}
+
+World::World(uint64_t seed) : seed(canonicalSeed(seed)), prune_octaves(false), prefilter(true), index(nullptr), store(nullptr), progress(nullptr), noises(nullptr), caves(nullptr) {
+}
+
+World::World(World &&other) noexcept : seed(other.seed), prune_octaves(other.prune_octaves), prefilter(other.prefilter), index(other.index), store(other.store), progress(other.progress), noises(other.noises), caves(other.caves), chunks(std::move(other.chunks)) {
+    other.noises = nullptr;
+    other.caves = nullptr;
+    other.chunks.clear();
+}
+
+World &World::operator=(World &&other) noexcept {
+    if (this != &other) {
+        free_world(*this);
+        seed = other.seed;
+        prune_octaves = other.prune_octaves;
+        prefilter = other.prefilter;
+        index = other.index;
+        store = other.store;
+        progress = other.progress;
+        destroyNoiseContext(noises);
+        noises = other.noises;
+        other.noises = nullptr;
+        delete caves;
+        caves = other.caves;
+        other.caves = nullptr;
+        chunks = std::move(other.chunks);
+        other.chunks.clear();
+    }
+    return *this;
+}
+
+World::~World() {
+    free_world(*this);
+    destroyNoiseContext(noises);
+    delete caves;
 }
 
 World new_world(uint64_t seed) {
-    World w;
-    w.seed = seed;
-    return w;
+    return World(seed);
 }
 
-void free_world(World world) {
+// each chunk goes back to where it came from, the world's store may have been set or swapped since
+void free_world(World &world) {
     for (const auto& [position, chunk] : world.chunks) {
-        delete chunk.blocks;
+        if (chunk.store) {
+            releaseChunk(chunk.store, chunk.cx, chunk.cz);
+        } else {
+            delete[] chunk.blocks;
+        }
     }
+    world.chunks.clear();
+}
+
+World *world_create(uint64_t seed) {
+    return new World(seed);
+}
+
+void world_destroy(World *world) {
+    delete world;
+}
+
+void world_set_prune_octaves(World *world, bool enabled) {
+    world->prune_octaves = enabled;
+}
+
+void world_set_prefilter(World *world, bool enabled) {
+    world->prefilter = enabled;
+}
+
+DungeonResult world_chunk_has_dungeon(World *world, int chunkX, int chunkZ) {
+    return chunkHasDungeon(world, chunkX, chunkZ);
 }
@@ -0,0 +1,30 @@
+#ifndef BETA_DUNGEONS_H_
+#define BETA_DUNGEONS_H_
+
+/* C handle API for FFI callers, the World is opaque on this side. */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct World World;
+
+typedef struct {
+    int x, z;
+    bool has_dungeon;
+} DungeonResult;
+
+World *world_create(uint64_t seed);
+void world_destroy(World *world);
+void world_set_prune_octaves(World *world, bool enabled);
+void world_set_prefilter(World *world, bool enabled);
+DungeonResult world_chunk_has_dungeon(World *world, int chunkX, int chunkZ);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BETA_DUNGEONS_H_ */
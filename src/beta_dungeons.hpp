@@ -1,23 +1,413 @@
 #pragma once
 #include <cstdint>
 
+#include "beta_dungeons.h"
+
 typedef struct {
     int cx, cz;
     uint8_t *blocks;
+    // the store the blocks were acquired from and go back to, null when they were generated for this chunk alone
+    struct ChunkStore *store;
 } Chunk;
 
 #include <map>
+#include <tuple>
+#include <vector>
+#include <string>
+#include <future>
 
-typedef struct {
+struct DungeonIndex;
+struct ChunkStore;
+struct NoiseContext;
+struct CaveMap;
+struct ScanProgress;
+
+// Every seed dependent step goes through the 48 bit Java LCG (setSeed/get_random mask the seed), so terrain and
+// dungeons depend only on the low 48 bits. Worlds, stores, indexes and batch scans key everything by that part,
+// and the 2^16 seeds sharing it differ only in the high bits.
+#define SEED_BITS 48
+#define SEED_MASK ((1ULL << SEED_BITS) - 1)
+
+static inline uint64_t canonicalSeed(uint64_t seed) {
+    return seed & SEED_MASK;
+}
+
+// the high'th of the 64 bit seeds equivalent to seed (high 0 is the canonical one)
+static inline uint64_t equivalentSeed(uint64_t seed, uint16_t high) {
+    return canonicalSeed(seed) | (uint64_t)high << SEED_BITS;
+}
+
+// Owns the generated chunk buffers, it can be moved but never copied so a chunk map is never duplicated.
+struct World {
+    // canonical, see canonicalSeed
     uint64_t seed;
+    // decide solid/air from octave bounds and only evaluate exact densities where a cell's sign is open,
+    // the generated blocks are identical either way
+    bool prune_octaves;
+    // rule candidates out from float32 density bounds before any of their chunks are generated, on by default.
+    // Only provable failures are dropped so the answers are identical either way
+    bool prefilter;
+    // answers chunkHasDungeon for already scanned chunks and records new ones, not owned by the world
+    DungeonIndex *index;
+    // shared chunk cache for multi-threaded scans, not owned by the world. When set, chunks holds the chunks this
+    // world has acquired from the store and chunkHasDungeon hands them back once it is done with a chunk. A store
+    // built for another seed or prune_octaves is never read, see worldStore
+    ChunkStore *store;
+    // counters and cancel flag of the scan this world works for, not owned by the world. Scans stop at their next
+    // chunk or work item once it is cancelled and return what they found until then
+    ScanProgress *progress;
+    // the seed's noise tables for chunk generation and the pre-filter, built on first use and owned by the world
+    NoiseContext *noises;
+    // tunnel counts of the cave source chunks and the reach of the caves in chunks, for the pre-filter. Filled as
+    // the scans ask for it and owned by the world
+    CaveMap *caves;
     std::map<std::tuple<int, int>, Chunk> chunks;
-} World;
 
-typedef struct {
-    int x, z;
-    bool has_dungeon;
-} DungeonResult;
+    explicit World(uint64_t seed = 0);
+    World(const World &) = delete;
+    World &operator=(const World &) = delete;
+    World(World &&other) noexcept;
+    World &operator=(World &&other) noexcept;
+    ~World();
+};
 
 World new_world(uint64_t seed);
+// A seed's octave tables, built once and only read afterwards so threads can generate from one context at once.
+NoiseContext *createNoiseContext(uint64_t seed);
+void destroyNoiseContext(NoiseContext *context);
+// generates a chunk (terrain and caves), the caller owns the returned blocks
+Chunk generateChunk(const NoiseContext *context, int32_t chunkX, int32_t chunkZ, bool pruneOctaves);
+// same as generateChunk with a context built for this one chunk
+Chunk TerrainWrapper(uint64_t worldSeed, int32_t chunkX, int32_t chunkZ, bool pruneOctaves);
 DungeonResult chunkHasDungeon(World *world, int chunkX, int chunkZ);
-void free_world(World world);
\ No newline at end of file
+// frees every cached chunk, the world stays usable and regenerates on demand
+void free_world(World &world);
+
+// One of the eight placement attempts of a chunk, centred on x,y,z with a (2*sizeX+1) x (2*sizeZ+1) room.
+typedef struct {
+    int x, y, z;
+    int sizeX, sizeZ;
+} DungeonCandidate;
+
+// RNG only stage of chunkHasDungeon: fills the attempts in the order they are tried and returns how many there
+// are (0 or 8). The reported dungeon, if any, is the first attempt whose terrain checks pass.
+int dungeonCandidates(uint64_t worldSeed, int chunkX, int chunkZ, DungeonCandidate candidates[8]);
+
+static inline bool dungeonCandidateInHeight(const DungeonCandidate &candidate) {
+    return candidate.y >= 1 && candidate.y + 4 < 128;
+}
+
+// Terrain free stage of chunkHasDungeon: bit i is set when candidate i is out of height or, with the world's
+// prefilter on, provably fails on the float32 densities and the cave rng. Those never need their chunks built.
+uint8_t screenDungeonCandidates(World *world, int chunkX, int chunkZ, const DungeonCandidate candidates[8], int count);
+// chunkHasDungeon after screenDungeonCandidates: the candidates set in rejected are skipped and the others go to
+// the terrain checks without being pre-filtered again
+DungeonResult chunkHasDungeonScreened(World *world, int chunkX, int chunkZ, uint8_t rejected);
+
+static inline int dungeonCandidateCornerX(const DungeonCandidate &candidate) {
+    return candidate.x - candidate.sizeX - 1;
+}
+
+static inline int dungeonCandidateCornerZ(const DungeonCandidate &candidate) {
+    return candidate.z - candidate.sizeZ - 1;
+}
+
+// Progress of a running scan (see scan_progress.cpp). Each thread counts into its own cache line, a report sums
+// them, so counting costs the scans next to nothing. Share one between the worlds, sweeps or seed scans to watch.
+typedef struct {
+    uint64_t chunks;     // checked, including those answered by an index
+    uint64_t candidates; // that reached the pre-filter or the terrain checks
+    uint64_t hits;
+    double seconds;      // since createScanProgress
+    double chunksPerSecond; // since the previous report for a reporter, over the whole scan otherwise
+    bool cancelled;
+} ScanProgressReport;
+
+typedef void (*ScanProgressCallback)(const ScanProgressReport *report, void *user);
+
+ScanProgress *createScanProgress();
+// stops the reporter if one is running
+void destroyScanProgress(ScanProgress *progress);
+void countScanProgress(ScanProgress *progress, uint64_t chunks, uint64_t candidates, uint64_t hits);
+ScanProgressReport readScanProgress(const ScanProgress *progress);
+// asks every scan using progress to stop, from any thread
+void cancelScan(ScanProgress *progress);
+// false for a null progress
+bool scanCancelled(const ScanProgress *progress);
+// calls report every intervalMillis on a thread of its own until stopProgressReporter, which reports once more
+void startProgressReporter(ScanProgress *progress, int intervalMillis, ScanProgressCallback report, void *user);
+void stopProgressReporter(ScanProgress *progress);
+
+// scans chunks [minChunkX, maxChunkX) x [minChunkZ, maxChunkZ) and appends every dungeon found
+void scanRegion(World *world, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, std::vector<DungeonResult> *results);
+
+typedef struct {
+    int chunkX, chunkZ;
+    int x, z;
+} IndexedDungeon;
+
+// Per seed file of scanned chunks and the dungeons found in them, mmap'd on open (see dungeon_index.cpp).
+// openDungeonIndex returns nullptr if the file exists but isn't a valid index for this seed.
+DungeonIndex *openDungeonIndex(const char *path, uint64_t seed);
+void closeDungeonIndex(DungeonIndex *index);
+// merges the chunks recorded since opening into the file, returns false if it couldn't be written
+bool saveDungeonIndex(DungeonIndex *index);
+std::string dungeonIndexPath(const char *directory, uint64_t seed);
+// returns false if the chunk hasn't been scanned yet, otherwise fills result
+bool indexLookupChunk(const DungeonIndex *index, int chunkX, int chunkZ, DungeonResult *result);
+void indexRecordChunk(DungeonIndex *index, int chunkX, int chunkZ, DungeonResult result);
+// appends the indexed dungeons within radius blocks of x,z, returns true only if every chunk that could
+// place a dungeon in range has been scanned (i.e. the answer is complete)
+bool queryDungeonsNear(const DungeonIndex *index, int x, int z, int radius, std::vector<IndexedDungeon> *dungeons);
+
+// The k dungeons closest to block x,z (by their reported corner) within maxRadius blocks, nearest first.
+// Chunks are visited ring by ring and ranked by their RNG candidates first, terrain is only generated for
+// chunks that could still beat the current k-th result, and the search stops once no unvisited chunk can.
+std::vector<IndexedDungeon> findNearestDungeons(World *world, int x, int z, int k, int maxRadius);
+// The same search a bounded number of chunk checks at a time, for callers that interleave it with other work on
+// the world. stepNearestSearch returns false while there is more to do, once it returns true nearest holds the
+// answer findNearestDungeons would give.
+struct NearestSearch;
+NearestSearch *createNearestSearch(int x, int z, int k, int maxRadius);
+void destroyNearestSearch(NearestSearch *search);
+bool stepNearestSearch(World *world, NearestSearch *search, int checks, std::vector<IndexedDungeon> *nearest);
+
+// Chunk cache shared by the threads of a scan. The first thread asking for a chunk generates it while the others
+// wait on that same entry, and only chunks no thread holds are evicted once the store is over capacity.
+ChunkStore *createChunkStore(uint64_t seed, bool pruneOctaves, size_t capacity);
+void destroyChunkStore(ChunkStore *store);
+// blocks of the chunk, valid until the matching releaseChunk. built is set when this call generated the chunk
+uint8_t *acquireChunk(ChunkStore *store, int chunkX, int chunkZ, bool *built = nullptr);
+// whether the chunk is cached or being generated right now, without pinning it
+bool chunkStoreHolds(ChunkStore *store, int chunkX, int chunkZ);
+void releaseChunk(ChunkStore *store, int chunkX, int chunkZ);
+size_t chunkStoreCapacity(const ChunkStore *store);
+// world's store if it was created for the world's seed and prune_octaves, null otherwise so the world generates its
+// own chunks instead of reading another seed's terrain
+ChunkStore *worldStore(const World *world);
+// chunks generated so far, against the chunks a scan needed this is how often evicted chunks had to be rebuilt
+uint64_t chunkStoreGenerated(const ChunkStore *store);
+
+// scanRegion on several threads with results in the same order. Each thread works on its own world with the seed and
+// prune_octaves of world, sharing world's store (or a private one); world's index is read for covered chunks and
+// receives the new ones at the end.
+void scanRegionParallel(World *world, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, int threads, std::vector<DungeonResult> *results);
+
+// What the pipelined scan's scheduler expected against what the scan did, for tuning the cost model.
+typedef struct {
+    uint64_t chunks;          // scheduled, i.e. not answered by the index
+    uint64_t candidates;      // in height
+    uint64_t screenedOut;     // candidates settled by the pre-filter before any of their chunks was built
+    uint64_t jobs;            // chunks with a candidate left, these went through the pipeline
+    uint64_t predictedChunks; // builds the scheduler expected from what the store held when it scheduled a job
+    uint64_t builtChunks;     // builds the generators actually did
+    uint64_t mispredictedJobs;
+} PipelineCosts;
+
+// scanRegion as a pipeline: the calling thread schedules chunks from their rng candidates and the pre-filter,
+// generator threads build and pin the chunks the surviving candidates will read, and checker threads run the
+// dungeon checks on chunks that are already built, so generation and checking overlap. Jobs are handed out in
+// windows, the ones whose chunks the store already holds first. Uses world's store (or a private one), same result
+// order. costs, if given, receives the scheduler's predictions and what the generators did.
+void scanRegionPipelined(World *world, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, int generators, int checkers, std::vector<DungeonResult> *results, PipelineCosts *costs = nullptr);
+
+// Dungeon counts over a region at several resolutions (see dungeon_heatmap.cpp). A cell of level l covers
+// (1 << (cellShift + l)) x (1 << (cellShift + l)) chunks aligned to that size, a dungeon counts in the cell of the
+// chunk that places it. cellShift 5 gives the 512x512 block cells of the index tiles.
+typedef struct {
+    int originX, originZ; // cell coordinates of counts[0]
+    int width, depth;
+    std::vector<uint32_t> counts; // x major
+} HeatmapLevel;
+
+typedef struct {
+    uint64_t seed;
+    int minChunkX, minChunkZ, maxChunkX, maxChunkZ;
+    int cellShift;
+    std::vector<HeatmapLevel> levels; // finest first
+} DungeonHeatmap;
+
+// scanRegionParallel reduced to counts: each thread adds its hits to its own copy of the finest level and the
+// copies are summed once the threads are done, so memory follows the number of cells, not of chunks or hits.
+// world's index answers the chunks it covers but isn't written to.
+DungeonHeatmap scanRegionHeatmap(World *world, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, int cellShift, int levels, int threads);
+// count of the level's cell holding the chunk, 0 outside the raster
+uint32_t heatmapCount(const DungeonHeatmap *heatmap, int level, int chunkX, int chunkZ);
+// compact binary raster, returns false if it couldn't be written / isn't a heatmap file
+bool writeDungeonHeatmap(const DungeonHeatmap *heatmap, const char *path);
+bool readDungeonHeatmap(const char *path, DungeonHeatmap *heatmap);
+
+// Chunk visiting orders shared by the scan drivers.
+enum ChunkWalkKind {
+    WALK_REGION, // [minX, maxX) x [minZ, maxZ), x major like the nested loops in example.cpp
+    WALK_SPIRAL, // square rings around (centerX, centerZ) out to maxRadius chunks
+    WALK_HILBERT // [minX, maxX) x [minZ, maxZ) along a Hilbert curve, see hilbertWalk
+};
+
+typedef struct {
+    ChunkWalkKind kind;
+    int minX, minZ, maxX, maxZ;
+    int centerX, centerZ, maxRadius;
+    int x, z;
+    int ring, step;
+    int bandSide, band, stopBand;
+    int64_t cell, stopCell;
+} ChunkWalk;
+
+ChunkWalk regionWalk(int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ);
+ChunkWalk spiralWalk(int centerChunkX, int centerChunkZ, int maxRadius);
+// Visits the region so that chunks close in the walk are close on the map at every scale, and with them the
+// neighbours their dungeon boxes read: one Hilbert curve per square band (side the next power of two of the short
+// side) laid along the long side, each band's curve ending next to where the next one starts.
+ChunkWalk hilbertWalk(int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ);
+// A Hilbert walk cut into tiles, aligned tileChunks^2 stretches of the curve (tileChunks a power of two), which are
+// squares on the map. Drivers hand these out as work items, walkTileChunks picks a size whose working set fits a
+// cache of the given number of chunks. Tiles lying outside the region walk no chunks.
+int hilbertTileCount(const ChunkWalk *walk, int tileChunks);
+ChunkWalk hilbertTile(const ChunkWalk *walk, int tileChunks, int tile);
+int walkTileChunks(size_t cacheChunks);
+// The order the region scans use for a cache of cacheChunks: row by row while the rows a box reaches into fit the
+// cache (nothing is generated twice then), the Hilbert walk once they don't.
+ChunkWalk scanWalk(int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, size_t cacheChunks);
+// worlds without a store never drop a chunk, scanning them is sized to keep the chunks in use in the CPU cache
+#define SCAN_CACHE_CHUNKS 512
+// returns false once every chunk of the walk has been handed out
+bool nextChunk(ChunkWalk *walk, int *chunkX, int *chunkZ);
+
+// Lazily yields the dungeons along a walk, chunks are only generated as the loop pulls the next hit, so breaking
+// out after the first few results stops the work there. With prefetch the search for the following hit runs on a
+// background thread while the loop body handles the current one; the world must not be touched from the loop
+// body in that mode.
+//
+//     for (const IndexedDungeon &dungeon : DungeonRange(&world, spiralWalk(0, 0, 64), true)) { ... }
+class DungeonRange {
+public:
+    DungeonRange(World *world, ChunkWalk walk, bool prefetch = false);
+    DungeonRange(const DungeonRange &) = delete;
+    DungeonRange &operator=(const DungeonRange &) = delete;
+    ~DungeonRange();
+
+    struct iterator {
+        DungeonRange *range;
+        const IndexedDungeon &operator*() const { return range->current; }
+        const IndexedDungeon *operator->() const { return &range->current; }
+        iterator &operator++() { range->advance(); return *this; }
+        bool operator!=(const iterator &other) const { return live() != other.live(); }
+        bool operator==(const iterator &other) const { return live() == other.live(); }
+        bool live() const { return range != nullptr && !range->done; }
+    };
+
+    iterator begin();
+    iterator end() { return iterator{nullptr}; }
+
+private:
+    void advance();
+
+    World *world;
+    ChunkWalk walk;
+    bool prefetch;
+    bool started;
+    bool done;
+    IndexedDungeon current;
+    IndexedDungeon ahead;
+    std::future<bool> aheadFound;
+};
+
+// A sweep over seeds [firstSeed, firstSeed + seedCount) x chunks [minChunkX, maxChunkX) x [minChunkZ, maxChunkZ),
+// split into one shard per seed and shardChunks x shardChunks tile. Any number of processes on machines sharing
+// directory can run runSweep at once: shards are claimed through lock files, a claimed shard saves its progress
+// every checkpointSeconds, and a claim left untouched for staleSeconds (a preempted worker) is taken over and
+// resumed from its last checkpoint (see sweep.cpp for the directory layout).
+typedef struct {
+    const char *directory;
+    uint64_t firstSeed, seedCount;
+    int minChunkX, minChunkZ, maxChunkX, maxChunkZ;
+    int shardChunks;
+    int checkpointSeconds;
+    int staleSeconds;
+    bool pruneOctaves;
+    // optional, a cancelled sweep checkpoints and unclaims the shard it is on and returns
+    ScanProgress *progress;
+} SweepConfig;
+
+typedef struct {
+    uint64_t seed;
+    IndexedDungeon dungeon;
+} SweepHit;
+
+uint64_t sweepShardCount(const SweepConfig *config);
+// scans shards until none is left to claim, returns how many this call completed or -1 if the directory can't be
+// used (including one that was started with a different config)
+int runSweep(const SweepConfig *config);
+// appends the dungeons of every finished shard in shard order, remaining is set to the number still unfinished
+bool collectSweepResults(const SweepConfig *config, std::vector<SweepHit> *hits, uint64_t *remaining);
+// Scans the region for every seed of the list and appends the hits in list order, each tagged with the seed as
+// given. The region is only scanned once per canonical seed, repeats and 64 bit aliases reuse that result.
+// With progress cancelled the hits stop at the last seed scanned in full.
+void scanSeeds(const uint64_t *seeds, size_t count, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, bool pruneOctaves, std::vector<SweepHit> *hits, ScanProgress *progress = nullptr);
+
+// Seed lists for batch runs (see seed_source.cpp), read a batch at a time so no list is ever held in memory.
+struct SeedSource;
+// seeds per batch handed to a worker, 32KB so a batch stays in cache while it is worked on
+#define SEED_BATCH 4096
+
+// a file of raw little endian uint64 seeds, mmap'd and paged in ahead of the consumers
+SeedSource *openSeedFile(const char *path);
+// a text file of whitespace separated decimal seeds (negative ones like Java prints them too), parsed in large
+// blocks by a reader thread that stays ahead of the consumers
+SeedSource *openSeedText(const char *path);
+// first, first + step, ... count seeds, generated on demand
+SeedSource *seedRange(uint64_t first, uint64_t count, uint64_t step);
+// lowBits with every value of the bits above lowBitCount counted up from 0, e.g. all seeds sharing 48 known bits
+SeedSource *seedHighBits(uint64_t lowBits, int lowBitCount, uint64_t count);
+void closeSeedSource(SeedSource *source);
+// copies up to capacity seeds in list order, returns 0 once the list is exhausted. Safe to call from several threads.
+size_t nextSeeds(SeedSource *source, uint64_t *seeds, size_t capacity);
+// scanSeeds over a whole source, threads pull SEED_BATCH seeds at a time and hits come out in source order. A
+// canonical seed is scanned once for the whole source, not once per batch.
+void scanSeedSource(SeedSource *source, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, int threads, bool pruneOctaves, std::vector<SweepHit> *hits, ScanProgress *progress = nullptr);
+
+// Query daemon on a Unix domain socket (see query_server.cpp). A client writes QueryRequests and reads back a
+// QueryReply followed by count IndexedDungeons (or one QueryStats for QUERY_STATS), any number per connection.
+enum QueryType : uint32_t {
+    QUERY_CHUNK = 1,   // args: chunkX, chunkZ
+    QUERY_REGION = 2,  // args: minChunkX, minChunkZ, maxChunkX, maxChunkZ, at most 65536 chunks
+    QUERY_NEAREST = 3, // args: x, z, k, maxRadius like findNearestDungeons
+    QUERY_STATS = 4    // latency percentiles of the requests answered so far, seed is ignored
+};
+
+enum QueryStatus : uint32_t {
+    QUERY_OK = 0,
+    QUERY_BAD_REQUEST = 1
+};
+
+typedef struct {
+    uint32_t type;
+    int32_t args[5];
+    uint64_t seed;
+} QueryRequest;
+
+typedef struct {
+    uint32_t status;
+    uint32_t count;
+} QueryReply;
+
+typedef struct {
+    uint64_t requests;
+    uint32_t p50Micros, p90Micros, p99Micros, maxMicros;
+} QueryStats;
+
+typedef struct {
+    const char *socketPath;
+    // seeds kept warm at once and chunks of terrain cached for each of them
+    int maxWorlds;
+    size_t chunksPerWorld;
+    bool pruneOctaves;
+} QueryServerConfig;
+
+// serves connections on their own threads, only returns (false) if the socket can't be set up or accept fails
+bool runQueryServer(const QueryServerConfig *config);
+// returns a connected socket or -1
+int connectQueryServer(const char *socketPath);
+// sends one request and reads its reply, dungeons are appended (stats is only filled for QUERY_STATS)
+bool sendQuery(int fd, const QueryRequest *request, QueryReply *reply, std::vector<IndexedDungeon> *dungeons, QueryStats *stats = nullptr);
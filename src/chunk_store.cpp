@@ -0,0 +1,149 @@
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "beta_dungeons.hpp"
+
+// Sharded so threads working on different areas rarely meet on a lock, a shard's lock is only held for the
+// table bookkeeping and never while a chunk is generated.
+#define STORE_SHARDS 64
+
+struct StoreEntry {
+    std::shared_future<uint8_t *> blocks;
+    uint32_t refs;
+    uint64_t lastUse;
+};
+
+struct StoreShard {
+    std::mutex lock;
+    std::unordered_map<uint64_t, StoreEntry> entries;
+    uint64_t tick;
+};
+
+struct ChunkStore {
+    uint64_t seed;
+    // shared by every generating thread, the octave tables are only read once built
+    NoiseContext *noises;
+    bool pruneOctaves;
+    size_t shardCapacity;
+    std::atomic<uint64_t> generated;
+    StoreShard shards[STORE_SHARDS];
+};
+
+static inline uint64_t storeKey(int chunkX, int chunkZ) {
+    return (uint64_t)(uint32_t)chunkX << 32 | (uint32_t)chunkZ;
+}
+
+static inline StoreShard &storeShard(ChunkStore *store, uint64_t key) {
+    uint64_t h = key * 0x9e3779b97f4a7c15ULL;
+    return store->shards[(h >> 58) % STORE_SHARDS];
+}
+
+// drops the least recently used chunks nobody holds until the shard fits, chunks still being generated or
+// acquired by a thread are never touched
+static void evictShard(ChunkStore *store, StoreShard &shard) {
+    while (shard.entries.size() > store->shardCapacity) {
+        auto victim = shard.entries.end();
+        for (auto it = shard.entries.begin(); it != shard.entries.end(); ++it) {
+            if (it->second.refs == 0 && (victim == shard.entries.end() || it->second.lastUse < victim->second.lastUse)) {
+                victim = it;
+            }
+        }
+        if (victim == shard.entries.end()) {
+            return;
+        }
+        delete[] victim->second.blocks.get();
+        shard.entries.erase(victim);
+    }
+}
+
+ChunkStore *createChunkStore(uint64_t seed, bool pruneOctaves, size_t capacity) {
+    auto *store = new ChunkStore;
+    store->seed = canonicalSeed(seed);
+    store->noises = createNoiseContext(store->seed);
+    store->pruneOctaves = pruneOctaves;
+    store->shardCapacity = capacity / STORE_SHARDS > 0 ? capacity / STORE_SHARDS : 1;
+    store->generated = 0;
+    for (StoreShard &shard : store->shards) {
+        shard.tick = 0;
+    }
+    return store;
+}
+
+void destroyChunkStore(ChunkStore *store) {
+    if (store == nullptr) {
+        return;
+    }
+    for (StoreShard &shard : store->shards) {
+        for (auto &[key, entry] : shard.entries) {
+            delete[] entry.blocks.get();
+        }
+    }
+    destroyNoiseContext(store->noises);
+    delete store;
+}
+
+uint8_t *acquireChunk(ChunkStore *store, int chunkX, int chunkZ, bool *built) {
+    uint64_t key = storeKey(chunkX, chunkZ);
+    StoreShard &shard = storeShard(store, key);
+    std::promise<uint8_t *> promise;
+    std::shared_future<uint8_t *> blocks;
+    bool owner = false;
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            it->second.refs++;
+            it->second.lastUse = ++shard.tick;
+            blocks = it->second.blocks;
+        } else {
+            owner = true;
+            blocks = promise.get_future().share();
+            shard.entries.emplace(key, StoreEntry{blocks, 1, ++shard.tick});
+            evictShard(store, shard);
+        }
+    }
+    if (owner) {
+        // everyone else asking for this chunk meanwhile waits on the future instead of generating it again
+        Chunk chunk = generateChunk(store->noises, chunkX, chunkZ, store->pruneOctaves);
+        store->generated++;
+        promise.set_value(chunk.blocks);
+    }
+    if (built) {
+        *built = owner;
+    }
+    return blocks.get();
+}
+
+bool chunkStoreHolds(ChunkStore *store, int chunkX, int chunkZ) {
+    uint64_t key = storeKey(chunkX, chunkZ);
+    StoreShard &shard = storeShard(store, key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.entries.find(key) != shard.entries.end();
+}
+
+void releaseChunk(ChunkStore *store, int chunkX, int chunkZ) {
+    uint64_t key = storeKey(chunkX, chunkZ);
+    StoreShard &shard = storeShard(store, key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end() && it->second.refs > 0) {
+        it->second.refs--;
+        evictShard(store, shard);
+    }
+}
+
+ChunkStore *worldStore(const World *world) {
+    ChunkStore *store = world->store;
+    return store && store->seed == world->seed && store->pruneOctaves == world->prune_octaves ? store : nullptr;
+}
+
+size_t chunkStoreCapacity(const ChunkStore *store) {
+    return store->shardCapacity * STORE_SHARDS;
+}
+
+uint64_t chunkStoreGenerated(const ChunkStore *store) {
+    return store->generated;
+}
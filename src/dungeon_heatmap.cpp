@@ -0,0 +1,199 @@
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <stdio.h>
+
+#include "beta_dungeons.hpp"
+
+// File layout, all little endian:
+//
+//   HeatmapHeader
+//   per level, finest first:
+//     HeatmapLevelHeader
+//     uint32_t counts[width * depth]   x major, cell (originX + i, originZ + j) at i * depth + j
+//
+// Level l cells are (1 << (cellShift + l)) chunks on a side and aligned to multiples of that in chunk coordinates,
+// so the cells of every level line up with each other and with the same raster of any other region.
+
+#define HEATMAP_MAGIC 0x4d484442u // "BDHM"
+#define HEATMAP_VERSION 1u
+
+struct HeatmapHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seed;
+    int32_t minChunkX, minChunkZ, maxChunkX, maxChunkZ;
+    int32_t cellShift;
+    uint32_t levelCount;
+    uint32_t reserved; // 0, keeps the header free of padding
+};
+
+struct HeatmapLevelHeader {
+    int32_t originX, originZ;
+    uint32_t width, depth;
+};
+
+static HeatmapLevel heatmapLevel(int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, int shift) {
+    HeatmapLevel level;
+    level.originX = minChunkX >> shift;
+    level.originZ = minChunkZ >> shift;
+    level.width = ((maxChunkX - 1) >> shift) - level.originX + 1;
+    level.depth = ((maxChunkZ - 1) >> shift) - level.originZ + 1;
+    level.counts.assign((size_t)level.width * level.depth, 0);
+    return level;
+}
+
+DungeonHeatmap scanRegionHeatmap(World *world, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, int cellShift, int levels, int threads) {
+    DungeonHeatmap heatmap;
+    heatmap.seed = world->seed;
+    heatmap.minChunkX = minChunkX;
+    heatmap.minChunkZ = minChunkZ;
+    heatmap.maxChunkX = maxChunkX;
+    heatmap.maxChunkZ = maxChunkZ;
+    heatmap.cellShift = cellShift < 0 ? 0 : cellShift > 24 ? 24 : cellShift;
+    if (maxChunkX <= minChunkX || maxChunkZ <= minChunkZ) {
+        return heatmap;
+    }
+    levels = levels < 1 ? 1 : levels > 31 - heatmap.cellShift ? 31 - heatmap.cellShift : levels;
+    threads = threads < 1 ? 1 : threads;
+
+    // same store and work items as scanRegionParallel, but every thread adds its hits to its own copy of the finest
+    // level instead of keeping a result per chunk
+    ChunkStore *store = worldStore(world) ? world->store : createChunkStore(world->seed, world->prune_octaves, (size_t)threads * SCAN_CACHE_CHUNKS);
+    size_t cacheChunks = chunkStoreCapacity(store) / threads;
+    int tileChunks = walkTileChunks(cacheChunks);
+    ChunkWalk region = scanWalk(minChunkX, minChunkZ, maxChunkX, maxChunkZ, cacheChunks);
+    int tiles = region.kind == WALK_HILBERT ? hilbertTileCount(&region, tileChunks) : maxChunkX - minChunkX;
+    HeatmapLevel finest = heatmapLevel(minChunkX, minChunkZ, maxChunkX, maxChunkZ, heatmap.cellShift);
+    std::mutex lock;
+    std::atomic<int> nextTile(0);
+    auto worker = [&]() {
+        World local(world->seed);
+        local.prune_octaves = world->prune_octaves;
+        local.prefilter = world->prefilter;
+        local.store = store;
+        local.progress = world->progress;
+        std::vector<uint32_t> counts(finest.counts.size(), 0);
+        int tile;
+        while (!scanCancelled(world->progress) && (tile = nextTile.fetch_add(1)) < tiles) {
+            ChunkWalk walk = region.kind == WALK_HILBERT ? hilbertTile(&region, tileChunks, tile) : regionWalk(minChunkX + tile, minChunkZ, minChunkX + tile + 1, maxChunkZ);
+            int chunkX, chunkZ;
+            while (nextChunk(&walk, &chunkX, &chunkZ)) {
+                DungeonResult result;
+                if (world->index && indexLookupChunk(world->index, chunkX, chunkZ, &result)) {
+                    if (world->progress) {
+                        countScanProgress(world->progress, 1, 0, result.has_dungeon);
+                    }
+                } else {
+                    result = chunkHasDungeon(&local, chunkX, chunkZ);
+                }
+                if (result.has_dungeon) {
+                    counts[(size_t)((chunkX >> heatmap.cellShift) - finest.originX) * finest.depth + ((chunkZ >> heatmap.cellShift) - finest.originZ)]++;
+                }
+            }
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i = 0; i < counts.size(); i++) {
+            finest.counts[i] += counts[i];
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : pool) {
+        thread.join();
+    }
+    if (store != world->store) {
+        destroyChunkStore(store);
+    }
+
+    // each coarser level sums the cells of the one below
+    heatmap.levels.push_back(std::move(finest));
+    for (int l = 1; l < levels; l++) {
+        HeatmapLevel coarse = heatmapLevel(minChunkX, minChunkZ, maxChunkX, maxChunkZ, heatmap.cellShift + l);
+        const HeatmapLevel &fine = heatmap.levels.back();
+        for (int i = 0; i < fine.width; i++) {
+            for (int j = 0; j < fine.depth; j++) {
+                int x = ((fine.originX + i) >> 1) - coarse.originX;
+                int z = ((fine.originZ + j) >> 1) - coarse.originZ;
+                coarse.counts[(size_t)x * coarse.depth + z] += fine.counts[(size_t)i * fine.depth + j];
+            }
+        }
+        heatmap.levels.push_back(std::move(coarse));
+    }
+    return heatmap;
+}
+
+uint32_t heatmapCount(const DungeonHeatmap *heatmap, int level, int chunkX, int chunkZ) {
+    if (level < 0 || level >= (int)heatmap->levels.size()) {
+        return 0;
+    }
+    const HeatmapLevel &cells = heatmap->levels[level];
+    int x = (chunkX >> (heatmap->cellShift + level)) - cells.originX;
+    int z = (chunkZ >> (heatmap->cellShift + level)) - cells.originZ;
+    if (x < 0 || x >= cells.width || z < 0 || z >= cells.depth) {
+        return 0;
+    }
+    return cells.counts[(size_t)x * cells.depth + z];
+}
+
+// written next to the target and renamed over it like the sweep files
+bool writeDungeonHeatmap(const DungeonHeatmap *heatmap, const char *path) {
+    std::string tmpPath = std::string(path) + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    bool ok = file != nullptr;
+    HeatmapHeader header = {HEATMAP_MAGIC, HEATMAP_VERSION, heatmap->seed, heatmap->minChunkX, heatmap->minChunkZ, heatmap->maxChunkX, heatmap->maxChunkZ, heatmap->cellShift, (uint32_t)heatmap->levels.size(), 0};
+    ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t l = 0; ok && l < heatmap->levels.size(); l++) {
+        const HeatmapLevel &level = heatmap->levels[l];
+        HeatmapLevelHeader levelHeader = {level.originX, level.originZ, (uint32_t)level.width, (uint32_t)level.depth};
+        ok = fwrite(&levelHeader, sizeof(levelHeader), 1, file) == 1;
+        ok = ok && (level.counts.empty() || fwrite(level.counts.data(), sizeof(uint32_t), level.counts.size(), file) == level.counts.size());
+    }
+    if (file && fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok || rename(tmpPath.c_str(), path) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool readDungeonHeatmap(const char *path, DungeonHeatmap *heatmap) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    HeatmapHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && header.magic == HEATMAP_MAGIC && header.version == HEATMAP_VERSION && header.levelCount <= 32;
+    if (ok) {
+        heatmap->seed = header.seed;
+        heatmap->minChunkX = header.minChunkX;
+        heatmap->minChunkZ = header.minChunkZ;
+        heatmap->maxChunkX = header.maxChunkX;
+        heatmap->maxChunkZ = header.maxChunkZ;
+        heatmap->cellShift = header.cellShift;
+        heatmap->levels.clear();
+    }
+    for (uint32_t l = 0; ok && l < header.levelCount; l++) {
+        HeatmapLevelHeader levelHeader;
+        ok = fread(&levelHeader, sizeof(levelHeader), 1, file) == 1 && levelHeader.width <= (1u << 24) && levelHeader.depth <= (1u << 24);
+        if (ok) {
+            HeatmapLevel level;
+            level.originX = levelHeader.originX;
+            level.originZ = levelHeader.originZ;
+            level.width = (int)levelHeader.width;
+            level.depth = (int)levelHeader.depth;
+            level.counts.resize((size_t)level.width * level.depth);
+            ok = level.counts.empty() || fread(level.counts.data(), sizeof(uint32_t), level.counts.size(), file) == level.counts.size();
+            heatmap->levels.push_back(std::move(level));
+        }
+    }
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,302 @@
+#include <map>
+#include <tuple>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rng.h"
+#include "beta_dungeons.hpp"
+
+// File layout, all little endian and naturally aligned so the file can be used straight from mmap:
+//
+//   IndexHeader
+//   IndexTile[tileCount]          sorted by (tileX, tileZ)
+//   IndexedDungeon[dungeonCount]  one sorted run per tile, ordered by (chunkX, chunkZ)
+//
+// A tile covers 32x32 chunks (512x512 blocks), covered[cx] bit cz is set once chunk
+// (tileX * 32 + cx, tileZ * 32 + cz) has been checked, whether or not it holds a dungeon.
+
+#define INDEX_MAGIC 0x58494442u // "BDIX"
+#define INDEX_VERSION 1u
+#define TILE_SHIFT 5
+#define TILE_SIZE (1 << TILE_SHIFT)
+
+struct IndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seed;
+    uint32_t tileCount;
+    uint32_t dungeonCount;
+};
+
+struct IndexTile {
+    int32_t tileX, tileZ;
+    uint32_t firstDungeon;
+    uint32_t dungeonCount;
+    uint32_t covered[TILE_SIZE];
+};
+
+struct TileBuilder {
+    uint32_t covered[TILE_SIZE];
+    std::vector<IndexedDungeon> dungeons;
+};
+
+struct DungeonIndex {
+    uint64_t seed;
+    std::string path;
+    const uint8_t *mapped;
+    size_t mappedSize;
+    const IndexTile *tiles;
+    uint32_t tileCount;
+    const IndexedDungeon *dungeons;
+    // chunks checked since the file was mapped, folded into the file by saveDungeonIndex
+    std::map<std::tuple<int, int>, TileBuilder> pending;
+};
+
+static void unmapIndex(DungeonIndex *index) {
+    if (index->mapped) {
+        munmap((void *)index->mapped, index->mappedSize);
+    }
+    index->mapped = nullptr;
+    index->mappedSize = 0;
+    index->tiles = nullptr;
+    index->tileCount = 0;
+    index->dungeons = nullptr;
+}
+
+// a missing file is an empty index, anything that doesn't parse for this seed is an error
+static bool mapIndex(DungeonIndex *index) {
+    int fd = open(index->path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return true;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    const auto *header = (const IndexHeader *)data;
+    size_t expected = sizeof(IndexHeader) + (size_t)header->tileCount * sizeof(IndexTile) + (size_t)header->dungeonCount * sizeof(IndexedDungeon);
+    if (header->magic != INDEX_MAGIC || header->version != INDEX_VERSION || canonicalSeed(header->seed) != index->seed || expected != (size_t)st.st_size) {
+        munmap(data, (size_t)st.st_size);
+        return false;
+    }
+    index->mapped = (const uint8_t *)data;
+    index->mappedSize = (size_t)st.st_size;
+    index->tiles = (const IndexTile *)(index->mapped + sizeof(IndexHeader));
+    index->tileCount = header->tileCount;
+    index->dungeons = (const IndexedDungeon *)(index->mapped + sizeof(IndexHeader) + (size_t)header->tileCount * sizeof(IndexTile));
+    return true;
+}
+
+static const IndexTile *findMappedTile(const DungeonIndex *index, int tileX, int tileZ) {
+    const IndexTile *end = index->tiles + index->tileCount;
+    const IndexTile *tile = std::lower_bound(index->tiles, end, std::make_tuple(tileX, tileZ), [](const IndexTile &t, const std::tuple<int, int> &key) {
+        return std::make_tuple(t.tileX, t.tileZ) < key;
+    });
+    if (tile == end || tile->tileX != tileX || tile->tileZ != tileZ) {
+        return nullptr;
+    }
+    return tile;
+}
+
+static bool dungeonBefore(const IndexedDungeon &a, const IndexedDungeon &b) {
+    return std::make_tuple(a.chunkX, a.chunkZ) < std::make_tuple(b.chunkX, b.chunkZ);
+}
+
+static void lookupRun(const IndexedDungeon *begin, const IndexedDungeon *end, int chunkX, int chunkZ, DungeonResult *result) {
+    IndexedDungeon key = {chunkX, chunkZ, 0, 0};
+    const IndexedDungeon *found = std::lower_bound(begin, end, key, dungeonBefore);
+    result->has_dungeon = found != end && found->chunkX == chunkX && found->chunkZ == chunkZ;
+    if (result->has_dungeon) {
+        result->x = found->x;
+        result->z = found->z;
+    }
+}
+
+std::string dungeonIndexPath(const char *directory, uint64_t seed) {
+    char name[32];
+    snprintf(name, sizeof(name), "%" PRIu64 ".bdix", canonicalSeed(seed));
+    return std::string(directory) + "/" + name;
+}
+
+DungeonIndex *openDungeonIndex(const char *path, uint64_t seed) {
+    auto *index = new DungeonIndex;
+    index->seed = canonicalSeed(seed);
+    index->path = path;
+    index->mapped = nullptr;
+    unmapIndex(index);
+    if (!mapIndex(index)) {
+        delete index;
+        return nullptr;
+    }
+    return index;
+}
+
+void closeDungeonIndex(DungeonIndex *index) {
+    if (index == nullptr) {
+        return;
+    }
+    unmapIndex(index);
+    delete index;
+}
+
+bool indexLookupChunk(const DungeonIndex *index, int chunkX, int chunkZ, DungeonResult *result) {
+    int tileX = chunkX >> TILE_SHIFT;
+    int tileZ = chunkZ >> TILE_SHIFT;
+    uint32_t bit = 1u << (chunkZ & (TILE_SIZE - 1));
+    int column = chunkX & (TILE_SIZE - 1);
+
+    const IndexTile *tile = index->tiles ? findMappedTile(index, tileX, tileZ) : nullptr;
+    if (tile && (tile->covered[column] & bit)) {
+        lookupRun(index->dungeons + tile->firstDungeon, index->dungeons + tile->firstDungeon + tile->dungeonCount, chunkX, chunkZ, result);
+        return true;
+    }
+    auto it = index->pending.find(std::make_tuple(tileX, tileZ));
+    if (it != index->pending.end() && (it->second.covered[column] & bit)) {
+        const std::vector<IndexedDungeon> &run = it->second.dungeons;
+        lookupRun(run.data(), run.data() + run.size(), chunkX, chunkZ, result);
+        return true;
+    }
+    return false;
+}
+
+void indexRecordChunk(DungeonIndex *index, int chunkX, int chunkZ, DungeonResult result) {
+    DungeonResult known;
+    if (indexLookupChunk(index, chunkX, chunkZ, &known)) {
+        return;
+    }
+    auto key = std::make_tuple(chunkX >> TILE_SHIFT, chunkZ >> TILE_SHIFT);
+    auto it = index->pending.find(key);
+    if (it == index->pending.end()) {
+        it = index->pending.emplace(key, TileBuilder()).first;
+        memset(it->second.covered, 0, sizeof(it->second.covered));
+    }
+    TileBuilder &tile = it->second;
+    uint32_t bit = 1u << (chunkZ & (TILE_SIZE - 1));
+    tile.covered[chunkX & (TILE_SIZE - 1)] |= bit;
+    if (result.has_dungeon) {
+        IndexedDungeon dungeon = {chunkX, chunkZ, result.x, result.z};
+        tile.dungeons.insert(std::upper_bound(tile.dungeons.begin(), tile.dungeons.end(), dungeon, dungeonBefore), dungeon);
+    }
+}
+
+bool saveDungeonIndex(DungeonIndex *index) {
+    if (index->pending.empty()) {
+        return true;
+    }
+    // fold the mapped tiles into the pending ones, both are kept sorted so this is a plain merge per tile
+    std::map<std::tuple<int, int>, TileBuilder> merged;
+    merged.swap(index->pending);
+    for (uint32_t i = 0; i < index->tileCount; i++) {
+        const IndexTile &tile = index->tiles[i];
+        auto key = std::make_tuple((int)tile.tileX, (int)tile.tileZ);
+        auto it = merged.find(key);
+        if (it == merged.end()) {
+            it = merged.emplace(key, TileBuilder()).first;
+            memset(it->second.covered, 0, sizeof(it->second.covered));
+        }
+        TileBuilder &builder = it->second;
+        for (int c = 0; c < TILE_SIZE; c++) {
+            builder.covered[c] |= tile.covered[c];
+        }
+        std::vector<IndexedDungeon> run(index->dungeons + tile.firstDungeon, index->dungeons + tile.firstDungeon + tile.dungeonCount);
+        std::vector<IndexedDungeon> both;
+        std::merge(run.begin(), run.end(), builder.dungeons.begin(), builder.dungeons.end(), std::back_inserter(both), dungeonBefore);
+        both.erase(std::unique(both.begin(), both.end(), [](const IndexedDungeon &a, const IndexedDungeon &b) {
+            return a.chunkX == b.chunkX && a.chunkZ == b.chunkZ;
+        }), both.end());
+        builder.dungeons.swap(both);
+    }
+
+    IndexHeader header = {INDEX_MAGIC, INDEX_VERSION, index->seed, (uint32_t)merged.size(), 0};
+    std::vector<IndexTile> tiles;
+    tiles.reserve(merged.size());
+    for (const auto &[key, builder] : merged) {
+        IndexTile tile;
+        tile.tileX = std::get<0>(key);
+        tile.tileZ = std::get<1>(key);
+        tile.firstDungeon = header.dungeonCount;
+        tile.dungeonCount = (uint32_t)builder.dungeons.size();
+        memcpy(tile.covered, builder.covered, sizeof(tile.covered));
+        header.dungeonCount += tile.dungeonCount;
+        tiles.push_back(tile);
+    }
+
+    // write next to the old file and rename over it so a mapped reader never sees a torn index
+    std::string tmpPath = index->path + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    bool ok = file != nullptr;
+    ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && (tiles.empty() || fwrite(tiles.data(), sizeof(IndexTile), tiles.size(), file) == tiles.size());
+    for (const auto &[key, builder] : merged) {
+        ok = ok && (builder.dungeons.empty() || fwrite(builder.dungeons.data(), sizeof(IndexedDungeon), builder.dungeons.size(), file) == builder.dungeons.size());
+    }
+    if (file && fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok || rename(tmpPath.c_str(), index->path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        // keep the results around so a later save can retry
+        index->pending.swap(merged);
+        return false;
+    }
+    unmapIndex(index);
+    return mapIndex(index);
+}
+
+bool queryDungeonsNear(const DungeonIndex *index, int x, int z, int radius, std::vector<IndexedDungeon> *dungeons) {
+    // a dungeon's corner lands in [chunk * 16 + 4, chunk * 16 + 20], so these are all the chunks that can place one in range
+    int minChunkX = floordiv(x - radius - 20 + 15, 16);
+    int maxChunkX = floordiv(x + radius - 4, 16);
+    int minChunkZ = floordiv(z - radius - 20 + 15, 16);
+    int maxChunkZ = floordiv(z + radius - 4, 16);
+    int64_t radiusSquared = (int64_t)radius * radius;
+    bool covered = true;
+
+    for (int tileX = minChunkX >> TILE_SHIFT; tileX <= maxChunkX >> TILE_SHIFT; tileX++) {
+        for (int tileZ = minChunkZ >> TILE_SHIFT; tileZ <= maxChunkZ >> TILE_SHIFT; tileZ++) {
+            const IndexTile *tile = index->tiles ? findMappedTile(index, tileX, tileZ) : nullptr;
+            auto it = index->pending.find(std::make_tuple(tileX, tileZ));
+            const TileBuilder *builder = it == index->pending.end() ? nullptr : &it->second;
+
+            int fromX = std::max(minChunkX, tileX * TILE_SIZE) & (TILE_SIZE - 1);
+            int toX = std::min(maxChunkX, tileX * TILE_SIZE + TILE_SIZE - 1) & (TILE_SIZE - 1);
+            int fromZ = std::max(minChunkZ, tileZ * TILE_SIZE) & (TILE_SIZE - 1);
+            int toZ = std::min(maxChunkZ, tileZ * TILE_SIZE + TILE_SIZE - 1) & (TILE_SIZE - 1);
+            uint32_t want = (toZ == TILE_SIZE - 1 ? ~0u : (1u << (toZ + 1)) - 1) & ~((1u << fromZ) - 1);
+            for (int c = fromX; covered && c <= toX; c++) {
+                uint32_t have = (tile ? tile->covered[c] : 0) | (builder ? builder->covered[c] : 0);
+                covered = (have & want) == want;
+            }
+
+            auto collect = [&](const IndexedDungeon *begin, const IndexedDungeon *end) {
+                for (const IndexedDungeon *dungeon = begin; dungeon != end; dungeon++) {
+                    int64_t dx = dungeon->x - x;
+                    int64_t dz = dungeon->z - z;
+                    if (dx * dx + dz * dz <= radiusSquared) {
+                        dungeons->push_back(*dungeon);
+                    }
+                }
+            };
+            if (tile) {
+                collect(index->dungeons + tile->firstDungeon, index->dungeons + tile->firstDungeon + tile->dungeonCount);
+            }
+            if (builder) {
+                collect(builder->dungeons.data(), builder->dungeons.data() + builder->dungeons.size());
+            }
+        }
+    }
+    return covered;
+}
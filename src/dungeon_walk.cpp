@@ -0,0 +1,418 @@
+#include <future>
+#include <thread>
+#include <atomic>
+#include <queue>
+#include <tuple>
+#include <algorithm>
+#include <climits>
+#include <stdint.h>
+
+#include "beta_dungeons.hpp"
+
+ChunkWalk regionWalk(int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ) {
+    ChunkWalk walk = {};
+    walk.kind = WALK_REGION;
+    walk.minX = minChunkX;
+    walk.minZ = minChunkZ;
+    walk.maxX = maxChunkX;
+    walk.maxZ = maxChunkZ;
+    walk.x = minChunkX;
+    walk.z = minChunkZ;
+    return walk;
+}
+
+ChunkWalk spiralWalk(int centerChunkX, int centerChunkZ, int maxRadius) {
+    ChunkWalk walk = {};
+    walk.kind = WALK_SPIRAL;
+    walk.centerX = centerChunkX;
+    walk.centerZ = centerChunkZ;
+    walk.maxRadius = maxRadius;
+    walk.minX = centerChunkX - maxRadius;
+    walk.minZ = centerChunkZ - maxRadius;
+    walk.maxX = centerChunkX + maxRadius + 1;
+    walk.maxZ = centerChunkZ + maxRadius + 1;
+    return walk;
+}
+
+ChunkWalk hilbertWalk(int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ) {
+    ChunkWalk walk = regionWalk(minChunkX, minChunkZ, maxChunkX, maxChunkZ);
+    walk.kind = WALK_HILBERT;
+    int width = maxChunkX - minChunkX;
+    int depth = maxChunkZ - minChunkZ;
+    if (width <= 0 || depth <= 0) {
+        walk.stopBand = -1;
+        return walk;
+    }
+    int shortSide = width < depth ? width : depth;
+    int longSide = width < depth ? depth : width;
+    walk.bandSide = 1;
+    while (walk.bandSide < shortSide) {
+        walk.bandSide *= 2;
+    }
+    walk.stopBand = (longSide + walk.bandSide - 1) / walk.bandSide;
+    walk.stopCell = 0;
+    return walk;
+}
+
+static int64_t hilbertTileCells(const ChunkWalk *walk, int tileChunks) {
+    int side = 1;
+    while (side * 2 <= tileChunks && side < walk->bandSide) {
+        side *= 2;
+    }
+    return (int64_t)side * side;
+}
+
+int hilbertTileCount(const ChunkWalk *walk, int tileChunks) {
+    if (walk->stopBand <= 0) {
+        return 0;
+    }
+    int64_t bandCells = (int64_t)walk->bandSide * walk->bandSide;
+    return (int)(walk->stopBand * (bandCells / hilbertTileCells(walk, tileChunks)));
+}
+
+ChunkWalk hilbertTile(const ChunkWalk *walk, int tileChunks, int tile) {
+    int64_t tileCells = hilbertTileCells(walk, tileChunks);
+    int64_t tilesPerBand = (int64_t)walk->bandSide * walk->bandSide / tileCells;
+    ChunkWalk part = *walk;
+    part.band = (int)(tile / tilesPerBand);
+    part.cell = tile % tilesPerBand * tileCells;
+    part.stopBand = part.band;
+    part.stopCell = part.cell + tileCells;
+    return part;
+}
+
+int walkTileChunks(size_t cacheChunks) {
+    // the tile being walked and the margin its boxes reach into, twice over for the tile just left behind
+    int tileChunks = 1;
+    while (2 * (size_t)(tileChunks * 2 + 2) * (size_t)(tileChunks * 2 + 2) <= cacheChunks && tileChunks < (1 << 14)) {
+        tileChunks *= 2;
+    }
+    return tileChunks;
+}
+
+ChunkWalk scanWalk(int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, size_t cacheChunks) {
+    // a box reaches one row back and one row ahead
+    if (3 * (size_t)(maxChunkZ > minChunkZ ? maxChunkZ - minChunkZ : 0) <= cacheChunks) {
+        return regionWalk(minChunkX, minChunkZ, maxChunkX, maxChunkZ);
+    }
+    return hilbertWalk(minChunkX, minChunkZ, maxChunkX, maxChunkZ);
+}
+
+// d'th cell of the Hilbert curve through an n x n square (n a power of two), from (0, 0) to (n - 1, 0)
+static void hilbertCell(int n, int64_t d, int *x, int *y) {
+    *x = 0;
+    *y = 0;
+    for (int s = 1; s < n; s *= 2) {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                *x = s - 1 - *x;
+                *y = s - 1 - *y;
+            }
+            std::swap(*x, *y);
+        }
+        *x += s * rx;
+        *y += s * ry;
+        d /= 4;
+    }
+}
+
+bool nextChunk(ChunkWalk *walk, int *chunkX, int *chunkZ) {
+    switch (walk->kind) {
+        case WALK_REGION:
+            if (walk->x >= walk->maxX || walk->minZ >= walk->maxZ) {
+                return false;
+            }
+            *chunkX = walk->x;
+            *chunkZ = walk->z;
+            if (++walk->z == walk->maxZ) {
+                walk->z = walk->minZ;
+                walk->x++;
+            }
+            return true;
+        case WALK_SPIRAL: {
+            if (walk->ring > walk->maxRadius) {
+                return false;
+            }
+            int r = walk->ring;
+            if (r == 0) {
+                *chunkX = walk->centerX;
+                *chunkZ = walk->centerZ;
+                walk->ring = 1;
+                walk->step = 0;
+                return true;
+            }
+            // ring r is the 8r chunks on the border of the (2r+1)^2 square, walked one side at a time
+            int side = walk->step / (2 * r);
+            int offset = walk->step % (2 * r);
+            switch (side) {
+                case 0: *chunkX = walk->centerX - r + offset; *chunkZ = walk->centerZ - r; break;
+                case 1: *chunkX = walk->centerX + r; *chunkZ = walk->centerZ - r + offset; break;
+                case 2: *chunkX = walk->centerX + r - offset; *chunkZ = walk->centerZ + r; break;
+                default: *chunkX = walk->centerX - r; *chunkZ = walk->centerZ + r - offset; break;
+            }
+            if (++walk->step == 8 * r) {
+                walk->ring++;
+                walk->step = 0;
+            }
+            return true;
+        }
+        case WALK_HILBERT: {
+            int side = walk->bandSide;
+            bool alongZ = walk->maxZ - walk->minZ >= walk->maxX - walk->minX;
+            for (;;) {
+                if (walk->cell == (int64_t)side * side) {
+                    walk->band++;
+                    walk->cell = 0;
+                }
+                if (walk->band > walk->stopBand || (walk->band == walk->stopBand && walk->cell >= walk->stopCell)) {
+                    return false;
+                }
+                int along, across;
+                hilbertCell(side, walk->cell++, &along, &across);
+                along += walk->band * side;
+                int x = walk->minX + (alongZ ? across : along);
+                int z = walk->minZ + (alongZ ? along : across);
+                if (x < walk->maxX && z < walk->maxZ) {
+                    *chunkX = x;
+                    *chunkZ = z;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+static bool findNextDungeon(World *world, ChunkWalk *walk, IndexedDungeon *found) {
+    int chunkX, chunkZ;
+    while (!scanCancelled(world->progress) && nextChunk(walk, &chunkX, &chunkZ)) {
+        DungeonResult result = chunkHasDungeon(world, chunkX, chunkZ);
+        if (result.has_dungeon) {
+            *found = (IndexedDungeon){.chunkX=chunkX, .chunkZ=chunkZ, .x=result.x, .z=result.z};
+            return true;
+        }
+    }
+    return false;
+}
+
+DungeonRange::DungeonRange(World *world, ChunkWalk walk, bool prefetch) : world(world), walk(walk), prefetch(prefetch), started(false), done(false), current(), ahead() {
+}
+
+DungeonRange::~DungeonRange() {
+    if (aheadFound.valid()) {
+        aheadFound.wait();
+    }
+}
+
+DungeonRange::iterator DungeonRange::begin() {
+    if (!started) {
+        started = true;
+        advance();
+    }
+    return iterator{this};
+}
+
+void DungeonRange::advance() {
+    if (aheadFound.valid()) {
+        done = !aheadFound.get();
+        current = ahead;
+    } else {
+        done = !findNextDungeon(world, &walk, &current);
+    }
+    if (prefetch && !done) {
+        aheadFound = std::async(std::launch::async, [this]() {
+            return findNextDungeon(world, &walk, &ahead);
+        });
+    }
+}
+
+struct NearestEntry {
+    int64_t distance; // squared, from the query point to the candidate or dungeon corner
+    bool resolved;
+    IndexedDungeon dungeon;
+};
+
+struct NearestFurther {
+    bool operator()(const NearestEntry &a, const NearestEntry &b) const {
+        if (a.distance != b.distance) return a.distance > b.distance;
+        if (a.resolved != b.resolved) return a.resolved; // settle unresolved chunks before emitting a tie
+        return std::make_tuple(a.dungeon.chunkX, a.dungeon.chunkZ) > std::make_tuple(b.dungeon.chunkX, b.dungeon.chunkZ);
+    }
+};
+
+struct NearestSearch {
+    int x, z, k;
+    int centerX, centerZ;
+    int64_t maxDistance;
+    int maxRing;
+    int ring;
+    std::priority_queue<NearestEntry, std::vector<NearestEntry>, NearestFurther> queue;
+    std::vector<IndexedDungeon> nearest;
+};
+
+NearestSearch *createNearestSearch(int x, int z, int k, int maxRadius) {
+    auto *search = new NearestSearch;
+    search->x = x;
+    search->z = z;
+    search->k = maxRadius < 0 ? 0 : k;
+    search->centerX = x >> 4;
+    search->centerZ = z >> 4;
+    search->maxDistance = (int64_t)maxRadius * maxRadius;
+    // a dungeon corner sits in [chunk * 16 + 4, chunk * 16 + 20], so every chunk of ring r is at least
+    // 16r - 20 blocks away along one axis
+    search->maxRing = (maxRadius + 20) / 16;
+    search->ring = 0;
+    return search;
+}
+
+void destroyNearestSearch(NearestSearch *search) {
+    delete search;
+}
+
+bool stepNearestSearch(World *world, NearestSearch *search, int checks, std::vector<IndexedDungeon> *nearest) {
+    auto &queue = search->queue;
+    bool finished = false;
+    while (!finished && checks > 0) {
+        if ((int)search->nearest.size() >= search->k || scanCancelled(world->progress)) {
+            finished = true;
+            break;
+        }
+        int64_t ringBound = std::max(0, 16 * search->ring - 20);
+        ringBound *= ringBound;
+        if (search->ring <= search->maxRing && (queue.empty() || queue.top().distance >= ringBound)) {
+            // just this ring of the spiral
+            ChunkWalk walk = spiralWalk(search->centerX, search->centerZ, search->ring);
+            walk.ring = search->ring;
+            int chunkX, chunkZ;
+            while (nextChunk(&walk, &chunkX, &chunkZ)) {
+                DungeonCandidate candidates[8];
+                int count = dungeonCandidates(world->seed, chunkX, chunkZ, candidates);
+                int64_t best = INT64_MAX;
+                for (int i = 0; i < count; i++) {
+                    if (!dungeonCandidateInHeight(candidates[i])) {
+                        continue;
+                    }
+                    int64_t dx = dungeonCandidateCornerX(candidates[i]) - search->x;
+                    int64_t dz = dungeonCandidateCornerZ(candidates[i]) - search->z;
+                    best = std::min(best, dx * dx + dz * dz);
+                }
+                // the reported dungeon is one of these corners, so none in range means nothing to find here
+                if (best <= search->maxDistance) {
+                    queue.push(NearestEntry{best, false, IndexedDungeon{chunkX, chunkZ, 0, 0}});
+                }
+            }
+            search->ring++;
+            continue;
+        }
+        if (queue.empty()) {
+            finished = true;
+            break;
+        }
+        NearestEntry entry = queue.top();
+        queue.pop();
+        if (entry.resolved) {
+            search->nearest.push_back(entry.dungeon);
+            continue;
+        }
+        checks--;
+        DungeonResult result = chunkHasDungeon(world, entry.dungeon.chunkX, entry.dungeon.chunkZ);
+        if (!result.has_dungeon) {
+            continue;
+        }
+        int64_t dx = result.x - search->x;
+        int64_t dz = result.z - search->z;
+        entry.distance = dx * dx + dz * dz;
+        if (entry.distance <= search->maxDistance) {
+            entry.resolved = true;
+            entry.dungeon.x = result.x;
+            entry.dungeon.z = result.z;
+            queue.push(entry);
+        }
+    }
+    if (finished) {
+        *nearest = std::move(search->nearest);
+        search->nearest.clear();
+    }
+    return finished;
+}
+
+std::vector<IndexedDungeon> findNearestDungeons(World *world, int x, int z, int k, int maxRadius) {
+    std::vector<IndexedDungeon> nearest;
+    NearestSearch *search = createNearestSearch(x, z, k, maxRadius);
+    while (!stepNearestSearch(world, search, INT_MAX, &nearest)) {
+    }
+    destroyNearestSearch(search);
+    return nearest;
+}
+
+struct ScannedChunk {
+    int chunkX, chunkZ;
+    DungeonResult result;
+    bool fresh; // not answered by the index, recorded into it once the threads are done
+};
+
+void scanRegionParallel(World *world, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, int threads, std::vector<DungeonResult> *results) {
+    if (maxChunkX <= minChunkX || maxChunkZ <= minChunkZ) {
+        return;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    // the threads share one cache so the chunks along the borders of their work items are only built once, a
+    // private store when the world has none for its seed
+    ChunkStore *store = worldStore(world) ? world->store : createChunkStore(world->seed, world->prune_octaves, (size_t)threads * SCAN_CACHE_CHUNKS);
+    // Work items are handed out in walk order so the ones in flight together are neighbours and share the store:
+    // x rows while every thread's rows fit its part of the store, tiles of a Hilbert walk sized to it otherwise.
+    size_t cacheChunks = chunkStoreCapacity(store) / threads;
+    int tileChunks = walkTileChunks(cacheChunks);
+    int depth = maxChunkZ - minChunkZ;
+    ChunkWalk region = scanWalk(minChunkX, minChunkZ, maxChunkX, maxChunkZ, cacheChunks);
+    int tiles = region.kind == WALK_HILBERT ? hilbertTileCount(&region, tileChunks) : maxChunkX - minChunkX;
+    std::vector<ScannedChunk> scanned((size_t)(maxChunkX - minChunkX) * depth);
+    std::atomic<int> nextTile(0);
+    auto worker = [&]() {
+        World local(world->seed);
+        local.prune_octaves = world->prune_octaves;
+        local.prefilter = world->prefilter;
+        local.store = store;
+        local.progress = world->progress;
+        int tile;
+        while (!scanCancelled(world->progress) && (tile = nextTile.fetch_add(1)) < tiles) {
+            ChunkWalk walk = region.kind == WALK_HILBERT ? hilbertTile(&region, tileChunks, tile) : regionWalk(minChunkX + tile, minChunkZ, minChunkX + tile + 1, maxChunkZ);
+            int chunkX, chunkZ;
+            while (nextChunk(&walk, &chunkX, &chunkZ)) {
+                ScannedChunk &chunk = scanned[(size_t)(chunkX - minChunkX) * depth + (chunkZ - minChunkZ)];
+                chunk = {chunkX, chunkZ, DungeonResult(), false};
+                if (world->index && indexLookupChunk(world->index, chunkX, chunkZ, &chunk.result)) {
+                    if (world->progress) {
+                        countScanProgress(world->progress, 1, 0, chunk.result.has_dungeon);
+                    }
+                } else {
+                    chunk.result = chunkHasDungeon(&local, chunkX, chunkZ);
+                    chunk.fresh = true;
+                }
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : pool) {
+        thread.join();
+    }
+    if (store != world->store) {
+        destroyChunkStore(store);
+    }
+    for (const ScannedChunk &chunk : scanned) {
+        if (world->index && chunk.fresh) {
+            indexRecordChunk(world->index, chunk.chunkX, chunk.chunkZ, chunk.result);
+        }
+        if (chunk.result.has_dungeon) {
+            results->push_back(chunk.result);
+        }
+    }
+}
@@ -0,0 +1,341 @@
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <condition_variable>
+#include <algorithm>
+#include <unordered_map>
+#include <chrono>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "beta_dungeons.hpp"
+
+// Upper bounds on what a single request may ask for.
+#define MAX_QUERY_REGION_CHUNKS 65536
+#define MAX_QUERY_NEAREST 1024
+#define MAX_QUERY_RADIUS 100000
+// Regions and nearest searches are answered this many chunk checks at a time and queued again in between, so the
+// chunk queries of a seed wait for at most one slice of cold terrain (a fraction of a second) instead of all of it.
+#define QUERY_REGION_SLICE 256
+// chunk answers remembered per seed, the table is dropped wholesale when it fills up
+#define MAX_SEED_ANSWERS (1 << 20)
+// recent request latencies kept for the percentiles
+#define LATENCY_SAMPLES 8192
+
+struct PendingQuery {
+    const QueryRequest *request;
+    std::vector<IndexedDungeon> *dungeons;
+    uint32_t status;
+    bool done;
+    // QUERY_REGION: where the next slice starts
+    bool walking;
+    ChunkWalk walk;
+    // QUERY_NEAREST: the search so far, owned by the query until it is answered
+    NearestSearch *nearest;
+};
+
+// A warm seed: its world keeps terrain in a bounded store and chunk answers in a table. Requests for the seed are
+// queued, whichever connection finds nobody draining the queue answers everything queued so far as one batch.
+struct SeedWorld {
+    World world;
+    std::unordered_map<uint64_t, DungeonResult> answers;
+    std::mutex lock;
+    std::condition_variable finished;
+    std::vector<PendingQuery *> pending;
+    bool draining;
+    uint64_t lastUse;
+
+    SeedWorld(uint64_t seed, bool pruneOctaves, size_t chunks) : world(seed), draining(false), lastUse(0) {
+        world.prune_octaves = pruneOctaves;
+        world.store = createChunkStore(seed, pruneOctaves, chunks);
+    }
+
+    ~SeedWorld() {
+        free_world(world);
+        destroyChunkStore(world.store);
+        world.store = nullptr;
+    }
+};
+
+struct QueryServer {
+    QueryServerConfig config;
+    std::mutex lock;
+    std::unordered_map<uint64_t, std::shared_ptr<SeedWorld>> worlds;
+    uint64_t tick;
+    uint64_t requests;
+    uint32_t latencies[LATENCY_SAMPLES];
+};
+
+static bool readFully(int fd, void *buffer, size_t size) {
+    uint8_t *bytes = (uint8_t *)buffer;
+    while (size > 0) {
+        ssize_t got = read(fd, bytes, size);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        bytes += got;
+        size -= got;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const void *buffer, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)buffer;
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static std::shared_ptr<SeedWorld> seedWorld(QueryServer *server, uint64_t seed) {
+    // seeds sharing their low 48 bits share a world
+    seed = canonicalSeed(seed);
+    std::lock_guard<std::mutex> guard(server->lock);
+    auto it = server->worlds.find(seed);
+    if (it == server->worlds.end()) {
+        // the least recently used seed goes, a batch still running on it keeps its own reference
+        if (server->worlds.size() >= (size_t)server->config.maxWorlds) {
+            auto victim = server->worlds.begin();
+            for (auto other = server->worlds.begin(); other != server->worlds.end(); ++other) {
+                if (other->second->lastUse < victim->second->lastUse) {
+                    victim = other;
+                }
+            }
+            server->worlds.erase(victim);
+        }
+        it = server->worlds.emplace(seed, std::make_shared<SeedWorld>(seed, server->config.pruneOctaves, server->config.chunksPerWorld)).first;
+    }
+    it->second->lastUse = ++server->tick;
+    return it->second;
+}
+
+static DungeonResult answerChunk(SeedWorld *seed, int chunkX, int chunkZ) {
+    uint64_t key = (uint64_t)(uint32_t)chunkX << 32 | (uint32_t)chunkZ;
+    auto it = seed->answers.find(key);
+    if (it != seed->answers.end()) {
+        return it->second;
+    }
+    if (seed->answers.size() >= MAX_SEED_ANSWERS) {
+        seed->answers.clear();
+    }
+    DungeonResult result = chunkHasDungeon(&seed->world, chunkX, chunkZ);
+    seed->answers.emplace(key, result);
+    return result;
+}
+
+// returns false when the query isn't answered in full yet, it is to be queued again
+static bool answerQuery(SeedWorld *seed, PendingQuery *query) {
+    const QueryRequest &request = *query->request;
+    query->status = QUERY_OK;
+    if (request.type == QUERY_CHUNK) {
+        DungeonResult result = answerChunk(seed, request.args[0], request.args[1]);
+        if (result.has_dungeon) {
+            query->dungeons->push_back((IndexedDungeon){.chunkX=request.args[0], .chunkZ=request.args[1], .x=result.x, .z=result.z});
+        }
+    } else if (request.type == QUERY_REGION) {
+        int64_t width = (int64_t)request.args[2] - request.args[0];
+        int64_t depth = (int64_t)request.args[3] - request.args[1];
+        if (width <= 0 || depth <= 0 || width * depth > MAX_QUERY_REGION_CHUNKS) {
+            query->status = QUERY_BAD_REQUEST;
+            return true;
+        }
+        if (!query->walking) {
+            query->walk = regionWalk(request.args[0], request.args[1], request.args[2], request.args[3]);
+            query->walking = true;
+        }
+        int chunkX, chunkZ;
+        for (int i = 0; i < QUERY_REGION_SLICE; i++) {
+            if (!nextChunk(&query->walk, &chunkX, &chunkZ)) {
+                return true;
+            }
+            DungeonResult result = answerChunk(seed, chunkX, chunkZ);
+            if (result.has_dungeon) {
+                query->dungeons->push_back((IndexedDungeon){.chunkX=chunkX, .chunkZ=chunkZ, .x=result.x, .z=result.z});
+            }
+        }
+        return false;
+    } else if (request.type == QUERY_NEAREST) {
+        if (request.args[2] < 1 || request.args[2] > MAX_QUERY_NEAREST || request.args[3] < 0 || request.args[3] > MAX_QUERY_RADIUS) {
+            query->status = QUERY_BAD_REQUEST;
+            return true;
+        }
+        if (query->nearest == nullptr) {
+            query->nearest = createNearestSearch(request.args[0], request.args[1], request.args[2], request.args[3]);
+        }
+        if (!stepNearestSearch(&seed->world, query->nearest, QUERY_REGION_SLICE, query->dungeons)) {
+            return false;
+        }
+        destroyNearestSearch(query->nearest);
+        query->nearest = nullptr;
+    } else {
+        query->status = QUERY_BAD_REQUEST;
+    }
+    return true;
+}
+
+// chunk queries of a batch are answered together in position order so neighbours find each other's terrain warm
+static bool batchOrder(const PendingQuery *a, const PendingQuery *b) {
+    if (a->request->type != b->request->type) {
+        return a->request->type < b->request->type;
+    }
+    if (a->request->type != QUERY_CHUNK) {
+        return false;
+    }
+    return a->request->args[0] != b->request->args[0] ? a->request->args[0] < b->request->args[0] : a->request->args[1] < b->request->args[1];
+}
+
+static void submitQuery(SeedWorld *seed, PendingQuery *query) {
+    std::unique_lock<std::mutex> guard(seed->lock);
+    seed->pending.push_back(query);
+    if (seed->draining) {
+        seed->finished.wait(guard, [&]() { return query->done; });
+        return;
+    }
+    seed->draining = true;
+    while (!seed->pending.empty()) {
+        std::vector<PendingQuery *> batch;
+        batch.swap(seed->pending);
+        guard.unlock();
+        std::stable_sort(batch.begin(), batch.end(), batchOrder);
+        std::vector<PendingQuery *> answered, unfinished;
+        for (PendingQuery *pending : batch) {
+            (answerQuery(seed, pending) ? answered : unfinished).push_back(pending);
+        }
+        guard.lock();
+        for (PendingQuery *pending : answered) {
+            pending->done = true;
+        }
+        // regions and searches with slices left go behind what arrived meanwhile, chunk queries are answered first
+        seed->pending.insert(seed->pending.end(), unfinished.begin(), unfinished.end());
+        seed->finished.notify_all();
+    }
+    seed->draining = false;
+}
+
+static QueryStats latencyStats(QueryServer *server) {
+    std::vector<uint32_t> samples;
+    QueryStats stats;
+    {
+        std::lock_guard<std::mutex> guard(server->lock);
+        stats.requests = server->requests;
+        size_t count = server->requests < LATENCY_SAMPLES ? (size_t)server->requests : LATENCY_SAMPLES;
+        samples.assign(server->latencies, server->latencies + count);
+    }
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](int p) { return samples.empty() ? 0 : samples[(samples.size() - 1) * p / 100]; };
+    stats.p50Micros = percentile(50);
+    stats.p90Micros = percentile(90);
+    stats.p99Micros = percentile(99);
+    stats.maxMicros = samples.empty() ? 0 : samples.back();
+    return stats;
+}
+
+static void serveConnection(QueryServer *server, int fd) {
+    QueryRequest request;
+    std::vector<IndexedDungeon> dungeons;
+    while (readFully(fd, &request, sizeof(request))) {
+        auto start = std::chrono::steady_clock::now();
+        dungeons.clear();
+        QueryReply reply = {QUERY_OK, 0};
+        bool ok;
+        if (request.type == QUERY_STATS) {
+            QueryStats stats = latencyStats(server);
+            reply.count = 1;
+            ok = writeFully(fd, &reply, sizeof(reply)) && writeFully(fd, &stats, sizeof(stats));
+        } else {
+            PendingQuery query = {&request, &dungeons, QUERY_OK, false, false, ChunkWalk(), nullptr};
+            submitQuery(seedWorld(server, request.seed).get(), &query);
+            reply.status = query.status;
+            reply.count = (uint32_t)dungeons.size();
+            ok = writeFully(fd, &reply, sizeof(reply)) && (dungeons.empty() || writeFully(fd, dungeons.data(), dungeons.size() * sizeof(IndexedDungeon)));
+            uint32_t micros = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            std::lock_guard<std::mutex> guard(server->lock);
+            server->latencies[server->requests++ % LATENCY_SAMPLES] = micros;
+        }
+        if (!ok) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+bool runQueryServer(const QueryServerConfig *config) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(config->socketPath) >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strcpy(address.sun_path, config->socketPath);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return false;
+    }
+    unlink(config->socketPath);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        close(listener);
+        return false;
+    }
+
+    auto *server = new QueryServer;
+    server->config = *config;
+    server->config.maxWorlds = config->maxWorlds > 0 ? config->maxWorlds : 1;
+    server->tick = 0;
+    server->requests = 0;
+    for (;;) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        std::thread(serveConnection, server, fd).detach();
+    }
+    // connections still being served keep using the server, it is only reclaimed with the process
+    close(listener);
+    return false;
+}
+
+int connectQueryServer(const char *socketPath) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool sendQuery(int fd, const QueryRequest *request, QueryReply *reply, std::vector<IndexedDungeon> *dungeons, QueryStats *stats) {
+    if (!writeFully(fd, request, sizeof(*request)) || !readFully(fd, reply, sizeof(*reply))) {
+        return false;
+    }
+    if (request->type == QUERY_STATS) {
+        QueryStats ignored;
+        return readFully(fd, stats ? stats : &ignored, sizeof(QueryStats));
+    }
+    size_t first = dungeons->size();
+    dungeons->resize(first + reply->count);
+    return reply->count == 0 || readFully(fd, dungeons->data() + first, reply->count * sizeof(IndexedDungeon));
+}
@@ -0,0 +1,279 @@
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <set>
+#include <tuple>
+#include <algorithm>
+
+#include "beta_dungeons.hpp"
+
+// Jobs in flight between the scheduler and the checkers, each holds its chunks pinned in the store.
+#define PIPELINE_SLOTS 64
+// a candidate's box spans at most 2x2 chunks, eight candidates can't need more than this
+#define MAX_JOB_CHUNKS 32
+// chunks the scheduler screens and orders together before handing their jobs out
+#define SCHEDULE_WINDOW 64
+
+struct PipelineJob {
+    size_t order;
+    int chunkX, chunkZ;
+    uint8_t rejected; // see screenDungeonCandidates
+    int predicted;    // of chunks, those the scheduler expects the generator to build
+    int chunkCount;
+    int chunks[MAX_JOB_CHUNKS][2];
+};
+
+struct Pipeline {
+    std::mutex lock;
+    std::condition_variable work;
+    std::condition_variable space;
+    PipelineJob slots[PIPELINE_SLOTS];
+    std::vector<int> freeSlots;
+    std::deque<int> toBuild;
+    std::deque<int> toCheck;
+    int inFlight;
+    bool scheduled;
+    PipelineCosts costs;
+};
+
+// chunks touched by the terrain checks of the candidates that survived screening, empty when none did
+static int jobChunks(const DungeonCandidate candidates[8], int count, uint8_t rejected, int chunks[MAX_JOB_CHUNKS][2]) {
+    int chunkCount = 0;
+    for (int i = 0; i < count; i++) {
+        const DungeonCandidate &candidate = candidates[i];
+        if (rejected & 1 << i) {
+            continue;
+        }
+        int fromX = (candidate.x - candidate.sizeX - 1) >> 4;
+        int toX = (candidate.x + candidate.sizeX + 1) >> 4;
+        int fromZ = (candidate.z - candidate.sizeZ - 1) >> 4;
+        int toZ = (candidate.z + candidate.sizeZ + 1) >> 4;
+        for (int x = fromX; x <= toX; x++) {
+            for (int z = fromZ; z <= toZ; z++) {
+                bool seen = false;
+                for (int j = 0; j < chunkCount && !seen; j++) {
+                    seen = chunks[j][0] == x && chunks[j][1] == z;
+                }
+                if (!seen && chunkCount < MAX_JOB_CHUNKS) {
+                    chunks[chunkCount][0] = x;
+                    chunks[chunkCount][1] = z;
+                    chunkCount++;
+                }
+            }
+        }
+    }
+    return chunkCount;
+}
+
+void scanRegionPipelined(World *world, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, int generators, int checkers, std::vector<DungeonResult> *results, PipelineCosts *costs) {
+    if (maxChunkX <= minChunkX || maxChunkZ <= minChunkZ) {
+        return;
+    }
+    generators = generators < 1 ? 1 : generators;
+    checkers = checkers < 1 ? 1 : checkers;
+    // the pinned chunks of every slot plus some room for neighbouring jobs to find theirs still cached
+    ChunkStore *store = worldStore(world) ? world->store : createChunkStore(world->seed, world->prune_octaves, PIPELINE_SLOTS * 8 + 1024);
+    size_t total = (size_t)(maxChunkX - minChunkX) * (size_t)(maxChunkZ - minChunkZ);
+    std::vector<DungeonResult> ordered(total);
+    std::vector<uint8_t> fresh(total, 0);
+
+    Pipeline pipeline;
+    for (int i = PIPELINE_SLOTS - 1; i >= 0; i--) {
+        pipeline.freeSlots.push_back(i);
+    }
+    pipeline.inFlight = 0;
+    pipeline.scheduled = false;
+    pipeline.costs = PipelineCosts();
+
+    auto generator = [&]() {
+        for (;;) {
+            int slot;
+            {
+                std::unique_lock<std::mutex> guard(pipeline.lock);
+                pipeline.work.wait(guard, [&]() { return !pipeline.toBuild.empty() || pipeline.scheduled; });
+                if (pipeline.toBuild.empty()) {
+                    return;
+                }
+                slot = pipeline.toBuild.front();
+                pipeline.toBuild.pop_front();
+            }
+            PipelineJob &job = pipeline.slots[slot];
+            int built = 0;
+            for (int i = 0; i < job.chunkCount; i++) {
+                bool fresh;
+                acquireChunk(store, job.chunks[i][0], job.chunks[i][1], &fresh);
+                built += fresh;
+            }
+            {
+                std::lock_guard<std::mutex> guard(pipeline.lock);
+                pipeline.costs.builtChunks += built;
+                pipeline.costs.mispredictedJobs += built != job.predicted;
+                pipeline.toCheck.push_back(slot);
+            }
+            pipeline.work.notify_all();
+        }
+    };
+
+    auto checker = [&]() {
+        World local(world->seed);
+        local.prune_octaves = world->prune_octaves;
+        local.prefilter = world->prefilter;
+        local.store = store;
+        local.progress = world->progress;
+        for (;;) {
+            int slot;
+            {
+                std::unique_lock<std::mutex> guard(pipeline.lock);
+                pipeline.work.wait(guard, [&]() { return !pipeline.toCheck.empty() || (pipeline.scheduled && pipeline.inFlight == 0); });
+                if (pipeline.toCheck.empty()) {
+                    return;
+                }
+                slot = pipeline.toCheck.front();
+                pipeline.toCheck.pop_front();
+            }
+            PipelineJob &job = pipeline.slots[slot];
+            ordered[job.order] = chunkHasDungeonScreened(&local, job.chunkX, job.chunkZ, job.rejected);
+            fresh[job.order] = 1;
+            for (int i = 0; i < job.chunkCount; i++) {
+                releaseChunk(store, job.chunks[i][0], job.chunks[i][1]);
+            }
+            {
+                std::lock_guard<std::mutex> guard(pipeline.lock);
+                pipeline.freeSlots.push_back(slot);
+                pipeline.inFlight--;
+            }
+            pipeline.space.notify_one();
+            pipeline.work.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i < generators; i++) {
+        pool.emplace_back(generator);
+    }
+    for (int i = 0; i < checkers; i++) {
+        pool.emplace_back(checker);
+    }
+
+    // The scheduler runs ahead on the terrain free stages: the rng candidates and the pre-filter, so candidates
+    // these settle never pin or build a chunk and chunks left without one never enter the pipeline. It walks so jobs
+    // close in time share their chunks in what the store holds beyond the pinned slots, results land in region
+    // order.
+    size_t capacity = chunkStoreCapacity(store);
+    int depth = maxChunkZ - minChunkZ;
+    ChunkWalk walk = scanWalk(minChunkX, minChunkZ, maxChunkX, maxChunkZ, capacity > PIPELINE_SLOTS * 8 ? capacity - PIPELINE_SLOTS * 8 : 0);
+    World screen(world->seed);
+    screen.prefilter = world->prefilter;
+    std::vector<PipelineJob> window;
+    // chunks of the jobs scheduled lately that are expected to be built, a job still in flight may not have
+    // reached the store with them yet
+    std::set<std::tuple<int, int>> pendingBuilds;
+    std::deque<std::tuple<int, int>> pendingOrder;
+    PipelineCosts scheduled = PipelineCosts();
+    auto submit = [&]() {
+        // jobs with all their chunks in the store go first, they pin those before the builds of the others can
+        // evict them. The building jobs keep walk order so the ones sharing chunks stay together
+        std::stable_partition(window.begin(), window.end(), [](const PipelineJob &job) { return job.predicted == 0; });
+        for (const PipelineJob &job : window) {
+            {
+                std::unique_lock<std::mutex> guard(pipeline.lock);
+                pipeline.space.wait(guard, [&]() { return !pipeline.freeSlots.empty(); });
+                int slot = pipeline.freeSlots.back();
+                pipeline.freeSlots.pop_back();
+                pipeline.slots[slot] = job;
+                pipeline.toBuild.push_back(slot);
+                pipeline.inFlight++;
+            }
+            pipeline.work.notify_all();
+        }
+        window.clear();
+    };
+    int chunkX, chunkZ;
+    while (!scanCancelled(world->progress) && nextChunk(&walk, &chunkX, &chunkZ)) {
+        size_t order = (size_t)(chunkX - minChunkX) * depth + (chunkZ - minChunkZ);
+        if (world->index && indexLookupChunk(world->index, chunkX, chunkZ, &ordered[order])) {
+            if (world->progress) {
+                countScanProgress(world->progress, 1, 0, ordered[order].has_dungeon);
+            }
+            continue;
+        }
+        scheduled.chunks++;
+        DungeonCandidate candidates[8];
+        int count = dungeonCandidates(world->seed, chunkX, chunkZ, candidates);
+        PipelineJob job;
+        job.order = order;
+        job.chunkX = chunkX;
+        job.chunkZ = chunkZ;
+        job.rejected = screenDungeonCandidates(&screen, chunkX, chunkZ, candidates, count);
+        int screenedOut = 0;
+        for (int i = 0; i < count; i++) {
+            if (dungeonCandidateInHeight(candidates[i])) {
+                scheduled.candidates++;
+                screenedOut += (job.rejected >> i) & 1;
+            }
+        }
+        scheduled.screenedOut += screenedOut;
+        job.chunkCount = jobChunks(candidates, count, job.rejected, job.chunks);
+        // the checkers count the chunks that become jobs and the candidates left in them
+        if (world->progress) {
+            countScanProgress(world->progress, job.chunkCount == 0, screenedOut, 0);
+        }
+        if (job.chunkCount == 0) {
+            ordered[order].has_dungeon = false;
+            fresh[order] = 1;
+            continue;
+        }
+        // a chunk neither in the store nor left to build by a recent job is this job's to build
+        job.predicted = 0;
+        for (int i = 0; i < job.chunkCount; i++) {
+            std::tuple<int, int> chunk(job.chunks[i][0], job.chunks[i][1]);
+            if (pendingBuilds.count(chunk) == 0 && !chunkStoreHolds(store, job.chunks[i][0], job.chunks[i][1])) {
+                job.predicted++;
+                pendingBuilds.insert(chunk);
+                pendingOrder.push_back(chunk);
+                if (pendingOrder.size() > PIPELINE_SLOTS * 8) {
+                    pendingBuilds.erase(pendingOrder.front());
+                    pendingOrder.pop_front();
+                }
+            }
+        }
+        scheduled.jobs++;
+        scheduled.predictedChunks += job.predicted;
+        window.push_back(job);
+        if (window.size() == SCHEDULE_WINDOW) {
+            submit();
+        }
+    }
+    // a cancelled scan drops the jobs it hasn't handed out, their chunks are left unreported
+    if (!scanCancelled(world->progress)) {
+        submit();
+    }
+    {
+        std::lock_guard<std::mutex> guard(pipeline.lock);
+        pipeline.scheduled = true;
+    }
+    pipeline.work.notify_all();
+    for (std::thread &thread : pool) {
+        thread.join();
+    }
+    if (costs) {
+        scheduled.builtChunks = pipeline.costs.builtChunks;
+        scheduled.mispredictedJobs = pipeline.costs.mispredictedJobs;
+        *costs = scheduled;
+    }
+
+    walk = regionWalk(minChunkX, minChunkZ, maxChunkX, maxChunkZ);
+    for (size_t order = 0; nextChunk(&walk, &chunkX, &chunkZ); order++) {
+        if (world->index && fresh[order]) {
+            indexRecordChunk(world->index, chunkX, chunkZ, ordered[order]);
+        }
+        if (ordered[order].has_dungeon) {
+            results->push_back(ordered[order]);
+        }
+    }
+    if (store != world->store) {
+        destroyChunkStore(store);
+    }
+}
@@ -0,0 +1,123 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "beta_dungeons.hpp"
+
+// threads past this many share slots, their adds are still atomic
+#define PROGRESS_SLOTS 64
+
+// one per thread and cache line, the scans only ever add to their own so counting never bounces a line
+struct alignas(64) ProgressSlot {
+    std::atomic<uint64_t> chunks;
+    std::atomic<uint64_t> candidates;
+    std::atomic<uint64_t> hits;
+};
+
+struct ScanProgress {
+    ProgressSlot slots[PROGRESS_SLOTS];
+    std::atomic<int> nextSlot;
+    std::atomic<bool> cancelled;
+    std::chrono::steady_clock::time_point started;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread reporter;
+    bool stopping;
+};
+
+ScanProgress *createScanProgress() {
+    auto *progress = new ScanProgress;
+    for (ProgressSlot &slot : progress->slots) {
+        slot.chunks = 0;
+        slot.candidates = 0;
+        slot.hits = 0;
+    }
+    progress->nextSlot = 0;
+    progress->cancelled = false;
+    progress->started = std::chrono::steady_clock::now();
+    progress->stopping = false;
+    return progress;
+}
+
+void destroyScanProgress(ScanProgress *progress) {
+    if (progress == nullptr) {
+        return;
+    }
+    stopProgressReporter(progress);
+    delete progress;
+}
+
+// the calling thread's slot, handed out on its first count for this progress
+static ProgressSlot &threadSlot(ScanProgress *progress) {
+    thread_local ScanProgress *owner = nullptr;
+    thread_local ProgressSlot *slot = nullptr;
+    if (owner != progress) {
+        owner = progress;
+        slot = &progress->slots[progress->nextSlot.fetch_add(1, std::memory_order_relaxed) % PROGRESS_SLOTS];
+    }
+    return *slot;
+}
+
+void countScanProgress(ScanProgress *progress, uint64_t chunks, uint64_t candidates, uint64_t hits) {
+    ProgressSlot &slot = threadSlot(progress);
+    slot.chunks.fetch_add(chunks, std::memory_order_relaxed);
+    slot.candidates.fetch_add(candidates, std::memory_order_relaxed);
+    slot.hits.fetch_add(hits, std::memory_order_relaxed);
+}
+
+ScanProgressReport readScanProgress(const ScanProgress *progress) {
+    ScanProgressReport report = {};
+    for (const ProgressSlot &slot : progress->slots) {
+        report.chunks += slot.chunks.load(std::memory_order_relaxed);
+        report.candidates += slot.candidates.load(std::memory_order_relaxed);
+        report.hits += slot.hits.load(std::memory_order_relaxed);
+    }
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - progress->started).count();
+    report.chunksPerSecond = report.seconds > 0 ? report.chunks / report.seconds : 0;
+    report.cancelled = scanCancelled(progress);
+    return report;
+}
+
+void cancelScan(ScanProgress *progress) {
+    progress->cancelled.store(true, std::memory_order_relaxed);
+}
+
+bool scanCancelled(const ScanProgress *progress) {
+    return progress != nullptr && progress->cancelled.load(std::memory_order_relaxed);
+}
+
+void startProgressReporter(ScanProgress *progress, int intervalMillis, ScanProgressCallback report, void *user) {
+    stopProgressReporter(progress);
+    progress->stopping = false;
+    std::chrono::milliseconds interval(intervalMillis < 1 ? 1 : intervalMillis);
+    progress->reporter = std::thread([progress, interval, report, user]() {
+        ScanProgressReport last = readScanProgress(progress);
+        bool stopping = false;
+        while (!stopping) {
+            {
+                std::unique_lock<std::mutex> guard(progress->lock);
+                stopping = progress->wake.wait_for(guard, interval, [progress]() { return progress->stopping; });
+            }
+            ScanProgressReport now = readScanProgress(progress);
+            double elapsed = now.seconds - last.seconds;
+            now.chunksPerSecond = elapsed > 0 ? (now.chunks - last.chunks) / elapsed : 0;
+            report(&now, user);
+            last = now;
+        }
+    });
+}
+
+void stopProgressReporter(ScanProgress *progress) {
+    if (!progress->reporter.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(progress->lock);
+        progress->stopping = true;
+    }
+    progress->wake.notify_all();
+    progress->reporter.join();
+}
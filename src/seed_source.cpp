@@ -0,0 +1,344 @@
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "beta_dungeons.hpp"
+
+// how far ahead of the handed out seeds a mapped file is paged in
+#define SEED_READAHEAD (8 << 20)
+// text is read in blocks of this size and parsed into SEED_BATCH sized batches by a reader thread
+#define SEED_TEXT_BLOCK (1 << 20)
+// parsed batches the reader may run ahead of the consumers
+#define SEED_TEXT_BATCHES_AHEAD 64
+// canonical seeds whose dungeons scanSeedSource remembers, the memo is dropped wholesale when it fills up
+#define SEED_MEMO_ENTRIES (1 << 18)
+
+enum SeedSourceKind {
+    SEEDS_MAPPED,
+    SEEDS_TEXT,
+    SEEDS_RANGE,
+    SEEDS_HIGH_BITS
+};
+
+struct SeedSource {
+    SeedSourceKind kind;
+    std::mutex lock;
+    uint64_t position, count;
+
+    // SEEDS_MAPPED
+    const uint64_t *mapped;
+    size_t mappedBytes;
+    size_t advisedBytes;
+
+    // SEEDS_RANGE: first + i * step, SEEDS_HIGH_BITS: first | i << lowBitCount
+    uint64_t first, step;
+    int lowBitCount;
+
+    // SEEDS_TEXT
+    int fd;
+    std::thread reader;
+    std::condition_variable filled;
+    std::condition_variable drained;
+    std::deque<std::vector<uint64_t>> ready;
+    std::vector<uint64_t> current;
+    size_t currentUsed;
+    bool finished;
+    bool stopping;
+};
+
+static SeedSource *newSeedSource(SeedSourceKind kind) {
+    auto *source = new SeedSource;
+    source->kind = kind;
+    source->position = 0;
+    source->count = 0;
+    source->mapped = nullptr;
+    source->mappedBytes = 0;
+    source->advisedBytes = 0;
+    source->first = 0;
+    source->step = 0;
+    source->lowBitCount = 0;
+    source->fd = -1;
+    source->currentUsed = 0;
+    source->finished = false;
+    source->stopping = false;
+    return source;
+}
+
+SeedSource *openSeedFile(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return nullptr;
+    }
+    SeedSource *source = newSeedSource(SEEDS_MAPPED);
+    // a trailing partial seed is ignored
+    source->count = (uint64_t)st.st_size / sizeof(uint64_t);
+    if (source->count > 0) {
+        void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            delete source;
+            return nullptr;
+        }
+        madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+        source->mapped = (const uint64_t *)mapped;
+        source->mappedBytes = st.st_size;
+    }
+    close(fd);
+    return source;
+}
+
+// Tokens are decimal seeds, optionally negative like Java prints them, separated by any whitespace. A token cut
+// by the end of a block is carried over into the next one.
+static void readSeedText(SeedSource *source) {
+    std::vector<char> block(SEED_TEXT_BLOCK);
+    std::vector<uint64_t> batch;
+    batch.reserve(SEED_BATCH);
+    uint64_t value = 0;
+    bool negative = false, inToken = false;
+    auto push = [&](std::vector<uint64_t> &full) {
+        std::unique_lock<std::mutex> guard(source->lock);
+        source->drained.wait(guard, [&]() { return source->ready.size() < SEED_TEXT_BATCHES_AHEAD || source->stopping; });
+        if (!source->stopping) {
+            source->ready.push_back(std::move(full));
+        }
+        source->filled.notify_all();
+        return !source->stopping;
+    };
+    bool running = true;
+    while (running) {
+        ssize_t got = read(source->fd, block.data(), block.size());
+        if (got <= 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < got && running; i++) {
+            char c = block[i];
+            if (c >= '0' && c <= '9') {
+                value = value * 10 + (uint64_t)(c - '0');
+                inToken = true;
+            } else if (c == '-' && !inToken) {
+                negative = true;
+            } else {
+                if (inToken) {
+                    batch.push_back(negative ? (uint64_t)0 - value : value);
+                    if (batch.size() == SEED_BATCH) {
+                        running = push(batch);
+                        batch = std::vector<uint64_t>();
+                        batch.reserve(SEED_BATCH);
+                    }
+                }
+                value = 0;
+                negative = false;
+                inToken = false;
+            }
+        }
+    }
+    if (inToken) {
+        batch.push_back(negative ? (uint64_t)0 - value : value);
+    }
+    if (running && !batch.empty()) {
+        push(batch);
+    }
+    std::lock_guard<std::mutex> guard(source->lock);
+    source->finished = true;
+    source->filled.notify_all();
+}
+
+SeedSource *openSeedText(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    SeedSource *source = newSeedSource(SEEDS_TEXT);
+    source->fd = fd;
+    source->reader = std::thread(readSeedText, source);
+    return source;
+}
+
+SeedSource *seedRange(uint64_t first, uint64_t count, uint64_t step) {
+    SeedSource *source = newSeedSource(SEEDS_RANGE);
+    source->first = first;
+    source->count = count;
+    source->step = step;
+    return source;
+}
+
+SeedSource *seedHighBits(uint64_t lowBits, int lowBitCount, uint64_t count) {
+    SeedSource *source = newSeedSource(SEEDS_HIGH_BITS);
+    source->lowBitCount = lowBitCount < 0 ? 0 : lowBitCount > 63 ? 63 : lowBitCount;
+    source->first = lowBits & ((1ULL << source->lowBitCount) - 1);
+    source->count = count;
+    if (source->lowBitCount > 0 && count > 1ULL << (64 - source->lowBitCount)) {
+        source->count = 1ULL << (64 - source->lowBitCount);
+    }
+    return source;
+}
+
+void closeSeedSource(SeedSource *source) {
+    if (source == nullptr) {
+        return;
+    }
+    if (source->kind == SEEDS_TEXT) {
+        {
+            std::lock_guard<std::mutex> guard(source->lock);
+            source->stopping = true;
+        }
+        source->drained.notify_all();
+        source->reader.join();
+        close(source->fd);
+    }
+    if (source->mapped) {
+        munmap((void *)source->mapped, source->mappedBytes);
+    }
+    delete source;
+}
+
+size_t nextSeeds(SeedSource *source, uint64_t *seeds, size_t capacity) {
+    std::unique_lock<std::mutex> guard(source->lock);
+    size_t taken = 0;
+    if (source->kind == SEEDS_TEXT) {
+        while (taken < capacity) {
+            if (source->currentUsed == source->current.size()) {
+                source->filled.wait(guard, [&]() { return !source->ready.empty() || source->finished; });
+                if (source->ready.empty()) {
+                    break;
+                }
+                source->current = std::move(source->ready.front());
+                source->ready.pop_front();
+                source->currentUsed = 0;
+                source->drained.notify_one();
+            }
+            size_t available = source->current.size() - source->currentUsed;
+            size_t n = available < capacity - taken ? available : capacity - taken;
+            memcpy(seeds + taken, source->current.data() + source->currentUsed, n * sizeof(uint64_t));
+            source->currentUsed += n;
+            taken += n;
+        }
+        source->position += taken;
+        return taken;
+    }
+
+    uint64_t left = source->count - source->position;
+    taken = left < capacity ? (size_t)left : capacity;
+    if (source->kind == SEEDS_MAPPED) {
+        memcpy(seeds, source->mapped + source->position, taken * sizeof(uint64_t));
+        // keep the pages after this batch coming in while the batch is worked on
+        size_t end = (size_t)(source->position + taken) * sizeof(uint64_t);
+        if (end + SEED_READAHEAD / 2 > source->advisedBytes && source->advisedBytes < source->mappedBytes) {
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t from = source->advisedBytes & ~(page - 1);
+            size_t to = end + SEED_READAHEAD < source->mappedBytes ? end + SEED_READAHEAD : source->mappedBytes;
+            madvise((uint8_t *)source->mapped + from, to - from, MADV_WILLNEED);
+            source->advisedBytes = to;
+        }
+    } else if (source->kind == SEEDS_RANGE) {
+        for (size_t i = 0; i < taken; i++) {
+            seeds[i] = source->first + (source->position + i) * source->step;
+        }
+    } else {
+        for (size_t i = 0; i < taken; i++) {
+            seeds[i] = source->first | (source->position + i) << source->lowBitCount;
+        }
+    }
+    source->position += taken;
+    return taken;
+}
+
+// the dungeons of one canonical seed, null when a cancel cut its scan short
+typedef std::shared_ptr<const std::vector<IndexedDungeon>> SeedDungeons;
+
+void scanSeedSource(SeedSource *source, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, int threads, bool pruneOctaves, std::vector<SweepHit> *hits, ScanProgress *progress) {
+    threads = threads < 1 ? 1 : threads;
+    std::mutex lock;
+    size_t nextBatch = 0;
+    std::map<size_t, std::vector<SweepHit>> found;
+    // shared by every batch so the aliases of a seed are scanned once however the list spreads them over batches
+    // and threads, the first thread to ask for a seed scans it while the others wait on that same entry
+    std::unordered_map<uint64_t, std::shared_future<SeedDungeons>> memo;
+    auto worker = [&]() {
+        std::vector<uint64_t> seeds(SEED_BATCH);
+        while (!scanCancelled(progress)) {
+            size_t batch, count;
+            {
+                // taken under our lock so batch numbers follow the order of the source
+                std::lock_guard<std::mutex> guard(lock);
+                count = nextSeeds(source, seeds.data(), seeds.size());
+                batch = nextBatch++;
+            }
+            if (count == 0) {
+                return;
+            }
+            std::vector<SweepHit> batchHits;
+            for (size_t i = 0; i < count; i++) {
+                uint64_t seed = canonicalSeed(seeds[i]);
+                std::promise<SeedDungeons> promise;
+                std::shared_future<SeedDungeons> dungeons;
+                bool owner = false;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    auto it = memo.find(seed);
+                    if (it != memo.end()) {
+                        dungeons = it->second;
+                    } else {
+                        if (memo.size() >= SEED_MEMO_ENTRIES) {
+                            memo.clear();
+                        }
+                        owner = true;
+                        dungeons = promise.get_future().share();
+                        memo.emplace(seed, dungeons);
+                    }
+                }
+                if (owner) {
+                    std::vector<SweepHit> seedHits;
+                    scanSeeds(&seed, 1, minChunkX, minChunkZ, maxChunkX, maxChunkZ, pruneOctaves, &seedHits, progress);
+                    SeedDungeons scanned;
+                    if (!scanCancelled(progress)) {
+                        auto whole = std::make_shared<std::vector<IndexedDungeon>>();
+                        for (const SweepHit &hit : seedHits) {
+                            whole->push_back(hit.dungeon);
+                        }
+                        scanned = whole;
+                    }
+                    promise.set_value(scanned);
+                }
+                SeedDungeons scanned = dungeons.get();
+                // like scanSeeds, the hits stop at the last seed scanned in full
+                if (!scanned) {
+                    break;
+                }
+                for (const IndexedDungeon &dungeon : *scanned) {
+                    batchHits.push_back((SweepHit){.seed=seeds[i], .dungeon=dungeon});
+                }
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            found[batch] = std::move(batchHits);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : pool) {
+        thread.join();
+    }
+    for (auto &[batch, batchHits] : found) {
+        hits->insert(hits->end(), batchHits.begin(), batchHits.end());
+    }
+}
@@ -0,0 +1,358 @@
+#include <atomic>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include "beta_dungeons.hpp"
+
+// Everything lives in the sweep directory so it works on any filesystem every worker can see:
+//
+//   sweep.cfg               the SweepConfig the directory was started with, later runs must match it
+//   claims/<shard>          created with O_EXCL by the worker scanning the shard, touched on every checkpoint
+//   partial/<shard>.ckpt    progress of a claimed shard: chunks done so far and the dungeons found in them
+//   results/<shard>.bin     final dungeons of a finished shard, its existence marks the shard as done
+//
+// Shard s covers seed firstSeed + s / tilesPerSeed and the s % tilesPerSeed'th shardChunks^2 tile of the region,
+// tiles numbered x major. Inside a shard chunks are visited in regionWalk order, so "chunks done" is a resume point.
+
+#define SWEEP_CONFIG_MAGIC 0x43575342u  // "BSWC"
+#define SHARD_RESULTS_MAGIC 0x52575342u // "BSWR"
+#define SHARD_PARTIAL_MAGIC 0x50575342u // "BSWP"
+
+struct SweepConfigFile {
+    uint32_t magic;
+    int32_t shardChunks;
+    uint64_t firstSeed;
+    uint64_t seedCount;
+    int32_t minChunkX, minChunkZ, maxChunkX, maxChunkZ;
+};
+
+struct ShardFileHeader {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t shard;
+    uint64_t seed;
+    uint64_t chunksDone;
+};
+
+struct ShardBounds {
+    uint64_t seed;
+    int minChunkX, minChunkZ, maxChunkX, maxChunkZ;
+};
+
+static int tilesAlong(int from, int to, int size) {
+    return (to - from + size - 1) / size;
+}
+
+uint64_t sweepShardCount(const SweepConfig *config) {
+    if (config->shardChunks <= 0 || config->maxChunkX <= config->minChunkX || config->maxChunkZ <= config->minChunkZ) {
+        return 0;
+    }
+    uint64_t tiles = (uint64_t)tilesAlong(config->minChunkX, config->maxChunkX, config->shardChunks) * (uint64_t)tilesAlong(config->minChunkZ, config->maxChunkZ, config->shardChunks);
+    return tiles * config->seedCount;
+}
+
+static ShardBounds shardBounds(const SweepConfig *config, uint64_t shard) {
+    uint64_t tilesZ = tilesAlong(config->minChunkZ, config->maxChunkZ, config->shardChunks);
+    uint64_t tilesPerSeed = (uint64_t)tilesAlong(config->minChunkX, config->maxChunkX, config->shardChunks) * tilesZ;
+    uint64_t tile = shard % tilesPerSeed;
+    ShardBounds bounds;
+    bounds.seed = config->firstSeed + shard / tilesPerSeed;
+    bounds.minChunkX = config->minChunkX + (int)(tile / tilesZ) * config->shardChunks;
+    bounds.minChunkZ = config->minChunkZ + (int)(tile % tilesZ) * config->shardChunks;
+    bounds.maxChunkX = bounds.minChunkX + config->shardChunks < config->maxChunkX ? bounds.minChunkX + config->shardChunks : config->maxChunkX;
+    bounds.maxChunkZ = bounds.minChunkZ + config->shardChunks < config->maxChunkZ ? bounds.minChunkZ + config->shardChunks : config->maxChunkZ;
+    return bounds;
+}
+
+static std::string shardPath(const SweepConfig *config, const char *kind, uint64_t shard, const char *suffix) {
+    char name[64];
+    snprintf(name, sizeof(name), "/%s/%" PRIu64 "%s", kind, shard, suffix);
+    return std::string(config->directory) + name;
+}
+
+static bool fileExists(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+// host.pid.n, different for every call across the machines sharing the directory. Names claims and temp files
+static std::string uniqueName() {
+    static std::atomic<uint64_t> calls(0);
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    char name[320];
+    snprintf(name, sizeof(name), "%s.%ld.%" PRIu64, host, (long)getpid(), calls++);
+    return name;
+}
+
+// Writes next to the target under a name of its own and renames over it once it is on disk, a reader or a
+// resuming worker never sees half a file and two writers of one shard never share a temp file.
+static bool writeShardFile(const std::string &path, const ShardFileHeader &header, const std::vector<IndexedDungeon> &dungeons) {
+    std::string tmpPath = path + ".tmp." + uniqueName();
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    bool ok = file != nullptr;
+    ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && (dungeons.empty() || fwrite(dungeons.data(), sizeof(IndexedDungeon), dungeons.size(), file) == dungeons.size());
+    // a crash after the rename must not leave a torn results file, claimShard takes any results file as final
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (file && fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool readShardFile(const std::string &path, uint32_t magic, uint64_t shard, ShardFileHeader *header, std::vector<IndexedDungeon> *dungeons) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = fread(header, sizeof(*header), 1, file) == 1 && header->magic == magic && header->shard == shard;
+    if (ok) {
+        size_t first = dungeons->size();
+        dungeons->resize(first + header->count);
+        ok = header->count == 0 || fread(dungeons->data() + first, sizeof(IndexedDungeon), header->count, file) == header->count;
+        if (!ok) {
+            dungeons->resize(first);
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+static bool checkSweepConfig(const SweepConfig *config) {
+    std::string directory = config->directory;
+    const char *subdirectories[] = {"", "/claims", "/partial", "/results"};
+    for (const char *subdirectory : subdirectories) {
+        if (mkdir((directory + subdirectory).c_str(), 0755) != 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+    SweepConfigFile wanted;
+    memset(&wanted, 0, sizeof(wanted));
+    wanted.magic = SWEEP_CONFIG_MAGIC;
+    wanted.shardChunks = config->shardChunks;
+    wanted.firstSeed = config->firstSeed;
+    wanted.seedCount = config->seedCount;
+    wanted.minChunkX = config->minChunkX;
+    wanted.minChunkZ = config->minChunkZ;
+    wanted.maxChunkX = config->maxChunkX;
+    wanted.maxChunkZ = config->maxChunkZ;
+
+    std::string path = directory + "/sweep.cfg";
+    int fd = open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+    if (fd >= 0) {
+        bool ok = write(fd, &wanted, sizeof(wanted)) == (ssize_t)sizeof(wanted);
+        close(fd);
+        return ok;
+    }
+    SweepConfigFile found;
+    FILE *file = fopen(path.c_str(), "rb");
+    bool ok = file != nullptr && fread(&found, sizeof(found), 1, file) == 1;
+    if (file) {
+        fclose(file);
+    }
+    return ok && memcmp(&found, &wanted, sizeof(found)) == 0;
+}
+
+static std::string readClaim(const std::string &path) {
+    char owner[320];
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return "";
+    }
+    size_t length = fread(owner, 1, sizeof(owner) - 1, file);
+    fclose(file);
+    while (length > 0 && owner[length - 1] == '\n') {
+        length--;
+    }
+    return std::string(owner, length);
+}
+
+// O_EXCL create is the lock, the claim holds the owner's token. A claim whose file hasn't been touched for
+// staleSeconds belongs to a worker that was preempted: it is renamed away and then claimed as usual. Another worker
+// may have taken it over between our stat and our rename, so what the rename caught is checked again and put back
+// if it turns out to be fresh. The owner also checks its token before every write (see scanShard), a claim taken
+// over under it makes it give the shard up.
+static bool claimShard(const SweepConfig *config, uint64_t shard, std::string *token) {
+    if (fileExists(shardPath(config, "results", shard, ".bin"))) {
+        return false;
+    }
+    std::string path = shardPath(config, "claims", shard, "");
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd >= 0) {
+            *token = uniqueName();
+            std::string owner = *token + "\n";
+            bool written = write(fd, owner.data(), owner.size()) == (ssize_t)owner.size();
+            close(fd);
+            // a worker may have finished the shard between our check and the claim
+            if (!written || fileExists(shardPath(config, "results", shard, ".bin"))) {
+                unlink(path.c_str());
+                return false;
+            }
+            return true;
+        }
+        struct stat st;
+        if (errno != EEXIST || stat(path.c_str(), &st) != 0 || time(nullptr) - st.st_mtime < config->staleSeconds) {
+            return false;
+        }
+        std::string stalePath = path + ".stale." + uniqueName();
+        if (rename(path.c_str(), stalePath.c_str()) != 0) {
+            return false;
+        }
+        struct stat renamed;
+        if (stat(stalePath.c_str(), &renamed) != 0 || time(nullptr) - renamed.st_mtime < config->staleSeconds) {
+            // someone else's fresh claim: link it back rather than rename so a claim made meanwhile isn't replaced
+            link(stalePath.c_str(), path.c_str());
+            unlink(stalePath.c_str());
+            return false;
+        }
+        unlink(stalePath.c_str());
+    }
+    return false;
+}
+
+// finished is left false when the scan was cancelled, the shard's progress is checkpointed and its claim released
+// so the next run (or another worker) resumes it right away. It is also left false when the claim stopped being
+// ours (token), the shard is then dropped without writing anything
+static bool scanShard(const SweepConfig *config, uint64_t shard, const std::string &token, bool *finished) {
+    ShardBounds bounds = shardBounds(config, shard);
+    std::string claimPath = shardPath(config, "claims", shard, "");
+    std::string partialPath = shardPath(config, "partial", shard, ".ckpt");
+
+    ShardFileHeader header = {SHARD_PARTIAL_MAGIC, 0, shard, bounds.seed, 0};
+    std::vector<IndexedDungeon> dungeons;
+    if (!readShardFile(partialPath, SHARD_PARTIAL_MAGIC, shard, &header, &dungeons)) {
+        header = (ShardFileHeader){SHARD_PARTIAL_MAGIC, 0, shard, bounds.seed, 0};
+        dungeons.clear();
+    }
+
+    World world = new_world(bounds.seed);
+    world.prune_octaves = config->pruneOctaves;
+    world.progress = config->progress;
+    ChunkWalk walk = regionWalk(bounds.minChunkX, bounds.minChunkZ, bounds.maxChunkX, bounds.maxChunkZ);
+    int chunkX, chunkZ;
+    for (uint64_t skipped = 0; skipped < header.chunksDone && nextChunk(&walk, &chunkX, &chunkZ); skipped++) {
+    }
+    time_t lastCheckpoint = time(nullptr);
+    *finished = false;
+    while (!scanCancelled(config->progress) && nextChunk(&walk, &chunkX, &chunkZ)) {
+        DungeonResult result = chunkHasDungeon(&world, chunkX, chunkZ);
+        if (result.has_dungeon) {
+            dungeons.push_back((IndexedDungeon){.chunkX=chunkX, .chunkZ=chunkZ, .x=result.x, .z=result.z});
+        }
+        header.chunksDone++;
+        if (time(nullptr) - lastCheckpoint >= config->checkpointSeconds) {
+            if (readClaim(claimPath) != token) {
+                return true;
+            }
+            header.count = (uint32_t)dungeons.size();
+            writeShardFile(partialPath, header, dungeons);
+            // refresh the claim so other workers don't take it for abandoned
+            utime(claimPath.c_str(), nullptr);
+            lastCheckpoint = time(nullptr);
+        }
+    }
+    if (readClaim(claimPath) != token) {
+        return true;
+    }
+    if (scanCancelled(config->progress)) {
+        header.count = (uint32_t)dungeons.size();
+        bool saved = writeShardFile(partialPath, header, dungeons);
+        unlink(claimPath.c_str());
+        return saved;
+    }
+    *finished = true;
+
+    header.magic = SHARD_RESULTS_MAGIC;
+    header.count = (uint32_t)dungeons.size();
+    if (!writeShardFile(shardPath(config, "results", shard, ".bin"), header, dungeons)) {
+        return false;
+    }
+    unlink(partialPath.c_str());
+    unlink(claimPath.c_str());
+    return true;
+}
+
+int runSweep(const SweepConfig *config) {
+    if (!checkSweepConfig(config)) {
+        return -1;
+    }
+    int completed = 0;
+    uint64_t shards = sweepShardCount(config);
+    for (uint64_t shard = 0; shard < shards && !scanCancelled(config->progress); shard++) {
+        std::string token;
+        if (!claimShard(config, shard, &token)) {
+            continue;
+        }
+        bool finished;
+        if (!scanShard(config, shard, token, &finished)) {
+            return -1;
+        }
+        completed += finished;
+    }
+    return completed;
+}
+
+bool collectSweepResults(const SweepConfig *config, std::vector<SweepHit> *hits, uint64_t *remaining) {
+    if (!checkSweepConfig(config)) {
+        return false;
+    }
+    *remaining = 0;
+    uint64_t shards = sweepShardCount(config);
+    for (uint64_t shard = 0; shard < shards; shard++) {
+        ShardFileHeader header;
+        std::vector<IndexedDungeon> dungeons;
+        if (!readShardFile(shardPath(config, "results", shard, ".bin"), SHARD_RESULTS_MAGIC, shard, &header, &dungeons)) {
+            (*remaining)++;
+            continue;
+        }
+        for (const IndexedDungeon &dungeon : dungeons) {
+            hits->push_back((SweepHit){.seed=header.seed, .dungeon=dungeon});
+        }
+    }
+    return true;
+}
+
+void scanSeeds(const uint64_t *seeds, size_t count, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, bool pruneOctaves, std::vector<SweepHit> *hits, ScanProgress *progress) {
+    std::unordered_map<uint64_t, std::vector<IndexedDungeon>> scanned;
+    for (size_t i = 0; i < count; i++) {
+        auto it = scanned.find(canonicalSeed(seeds[i]));
+        if (it == scanned.end()) {
+            World world(seeds[i]);
+            world.prune_octaves = pruneOctaves;
+            world.progress = progress;
+            std::vector<IndexedDungeon> dungeons;
+            ChunkWalk walk = regionWalk(minChunkX, minChunkZ, maxChunkX, maxChunkZ);
+            int chunkX, chunkZ;
+            while (!scanCancelled(progress) && nextChunk(&walk, &chunkX, &chunkZ)) {
+                DungeonResult result = chunkHasDungeon(&world, chunkX, chunkZ);
+                if (result.has_dungeon) {
+                    dungeons.push_back((IndexedDungeon){.chunkX=chunkX, .chunkZ=chunkZ, .x=result.x, .z=result.z});
+                }
+            }
+            // a seed cut short by a cancel reports nothing, the hits stop at the last whole seed
+            if (scanCancelled(progress)) {
+                return;
+            }
+            it = scanned.emplace(world.seed, std::move(dungeons)).first;
+        }
+        for (const IndexedDungeon &dungeon : it->second) {
+            hits->push_back((SweepHit){.seed=seeds[i], .dungeon=dungeon});
+        }
+    }
+}